@@ -42,8 +42,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // edge_load_model_internal
-SEXP edge_load_model_internal(std::string model_path, int n_ctx, int n_gpu_layers, int n_threads, bool flash_attn, bool embeddings);
-RcppExport SEXP _edgemodelr_edge_load_model_internal(SEXP model_pathSEXP, SEXP n_ctxSEXP, SEXP n_gpu_layersSEXP, SEXP n_threadsSEXP, SEXP flash_attnSEXP, SEXP embeddingsSEXP) {
+SEXP edge_load_model_internal(std::string model_path, int n_ctx, int n_gpu_layers, int n_threads, bool flash_attn, bool embeddings, int n_threads_batch, SEXP cpus, SEXP cpus_batch, int priority, int poll, bool strict_cpu, int numa, std::string cache_type_k, std::string cache_type_v, bool profile);
+RcppExport SEXP _edgemodelr_edge_load_model_internal(SEXP model_pathSEXP, SEXP n_ctxSEXP, SEXP n_gpu_layersSEXP, SEXP n_threadsSEXP, SEXP flash_attnSEXP, SEXP embeddingsSEXP, SEXP n_threads_batchSEXP, SEXP cpusSEXP, SEXP cpus_batchSEXP, SEXP prioritySEXP, SEXP pollSEXP, SEXP strict_cpuSEXP, SEXP numaSEXP, SEXP cache_type_kSEXP, SEXP cache_type_vSEXP, SEXP profileSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -53,13 +53,178 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
     Rcpp::traits::input_parameter< bool >::type flash_attn(flash_attnSEXP);
     Rcpp::traits::input_parameter< bool >::type embeddings(embeddingsSEXP);
-    rcpp_result_gen = Rcpp::wrap(edge_load_model_internal(model_path, n_ctx, n_gpu_layers, n_threads, flash_attn, embeddings));
+    Rcpp::traits::input_parameter< int >::type n_threads_batch(n_threads_batchSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type cpus(cpusSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type cpus_batch(cpus_batchSEXP);
+    Rcpp::traits::input_parameter< int >::type priority(prioritySEXP);
+    Rcpp::traits::input_parameter< int >::type poll(pollSEXP);
+    Rcpp::traits::input_parameter< bool >::type strict_cpu(strict_cpuSEXP);
+    Rcpp::traits::input_parameter< int >::type numa(numaSEXP);
+    Rcpp::traits::input_parameter< std::string >::type cache_type_k(cache_type_kSEXP);
+    Rcpp::traits::input_parameter< std::string >::type cache_type_v(cache_type_vSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_load_model_internal(model_path, n_ctx, n_gpu_layers, n_threads, flash_attn, embeddings, n_threads_batch, cpus, cpus_batch, priority, poll, strict_cpu, numa, cache_type_k, cache_type_v, profile));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_load_weights_internal
+SEXP edge_load_weights_internal(std::string model_path, int n_gpu_layers, int numa);
+RcppExport SEXP _edgemodelr_edge_load_weights_internal(SEXP model_pathSEXP, SEXP n_gpu_layersSEXP, SEXP numaSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type model_path(model_pathSEXP);
+    Rcpp::traits::input_parameter< int >::type n_gpu_layers(n_gpu_layersSEXP);
+    Rcpp::traits::input_parameter< int >::type numa(numaSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_load_weights_internal(model_path, n_gpu_layers, numa));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_new_context_internal
+SEXP edge_new_context_internal(SEXP weights_ptr, int n_ctx, int n_threads, bool flash_attn, bool embeddings, int n_threads_batch, SEXP cpus, SEXP cpus_batch, int priority, int poll, bool strict_cpu, std::string cache_type_k, std::string cache_type_v, bool profile);
+RcppExport SEXP _edgemodelr_edge_new_context_internal(SEXP weights_ptrSEXP, SEXP n_ctxSEXP, SEXP n_threadsSEXP, SEXP flash_attnSEXP, SEXP embeddingsSEXP, SEXP n_threads_batchSEXP, SEXP cpusSEXP, SEXP cpus_batchSEXP, SEXP prioritySEXP, SEXP pollSEXP, SEXP strict_cpuSEXP, SEXP cache_type_kSEXP, SEXP cache_type_vSEXP, SEXP profileSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type weights_ptr(weights_ptrSEXP);
+    Rcpp::traits::input_parameter< int >::type n_ctx(n_ctxSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type flash_attn(flash_attnSEXP);
+    Rcpp::traits::input_parameter< bool >::type embeddings(embeddingsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads_batch(n_threads_batchSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type cpus(cpusSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type cpus_batch(cpus_batchSEXP);
+    Rcpp::traits::input_parameter< int >::type priority(prioritySEXP);
+    Rcpp::traits::input_parameter< int >::type poll(pollSEXP);
+    Rcpp::traits::input_parameter< bool >::type strict_cpu(strict_cpuSEXP);
+    Rcpp::traits::input_parameter< std::string >::type cache_type_k(cache_type_kSEXP);
+    Rcpp::traits::input_parameter< std::string >::type cache_type_v(cache_type_vSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_new_context_internal(weights_ptr, n_ctx, n_threads, flash_attn, embeddings, n_threads_batch, cpus, cpus_batch, priority, poll, strict_cpu, cache_type_k, cache_type_v, profile));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_weights_info_internal
+List edge_weights_info_internal(SEXP weights_ptr);
+RcppExport SEXP _edgemodelr_edge_weights_info_internal(SEXP weights_ptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type weights_ptr(weights_ptrSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_weights_info_internal(weights_ptr));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_free_weights_internal
+void edge_free_weights_internal(SEXP weights_ptr);
+RcppExport SEXP _edgemodelr_edge_free_weights_internal(SEXP weights_ptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type weights_ptr(weights_ptrSEXP);
+    edge_free_weights_internal(weights_ptr);
+    return R_NilValue;
+END_RCPP
+}
+// edge_keep_warm_internal
+double edge_keep_warm_internal(double seconds);
+RcppExport SEXP _edgemodelr_edge_keep_warm_internal(SEXP secondsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< double >::type seconds(secondsSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_keep_warm_internal(seconds));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_model_resident_internal
+bool edge_model_resident_internal(std::string model_path, int n_gpu_layers);
+RcppExport SEXP _edgemodelr_edge_model_resident_internal(SEXP model_pathSEXP, SEXP n_gpu_layersSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type model_path(model_pathSEXP);
+    Rcpp::traits::input_parameter< int >::type n_gpu_layers(n_gpu_layersSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_model_resident_internal(model_path, n_gpu_layers));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_resident_models_internal
+DataFrame edge_resident_models_internal();
+RcppExport SEXP _edgemodelr_edge_resident_models_internal() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(edge_resident_models_internal());
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_set_threads_internal
+IntegerVector edge_set_threads_internal(SEXP model_ptr, int n_threads, int n_threads_batch);
+RcppExport SEXP _edgemodelr_edge_set_threads_internal(SEXP model_ptrSEXP, SEXP n_threadsSEXP, SEXP n_threads_batchSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads_batch(n_threads_batchSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_set_threads_internal(model_ptr, n_threads, n_threads_batch));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_sampler_internal
+SEXP edge_sampler_internal(SEXP model_ptr, double temperature, double top_p, int top_k, double min_p, double typical_p, double repeat_penalty, int penalty_last_n, double frequency_penalty, double presence_penalty, double dry_multiplier, double dry_base, int dry_allowed_length, int dry_penalty_last_n, double seed);
+RcppExport SEXP _edgemodelr_edge_sampler_internal(SEXP model_ptrSEXP, SEXP temperatureSEXP, SEXP top_pSEXP, SEXP top_kSEXP, SEXP min_pSEXP, SEXP typical_pSEXP, SEXP repeat_penaltySEXP, SEXP penalty_last_nSEXP, SEXP frequency_penaltySEXP, SEXP presence_penaltySEXP, SEXP dry_multiplierSEXP, SEXP dry_baseSEXP, SEXP dry_allowed_lengthSEXP, SEXP dry_penalty_last_nSEXP, SEXP seedSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    Rcpp::traits::input_parameter< double >::type temperature(temperatureSEXP);
+    Rcpp::traits::input_parameter< double >::type top_p(top_pSEXP);
+    Rcpp::traits::input_parameter< int >::type top_k(top_kSEXP);
+    Rcpp::traits::input_parameter< double >::type min_p(min_pSEXP);
+    Rcpp::traits::input_parameter< double >::type typical_p(typical_pSEXP);
+    Rcpp::traits::input_parameter< double >::type repeat_penalty(repeat_penaltySEXP);
+    Rcpp::traits::input_parameter< int >::type penalty_last_n(penalty_last_nSEXP);
+    Rcpp::traits::input_parameter< double >::type frequency_penalty(frequency_penaltySEXP);
+    Rcpp::traits::input_parameter< double >::type presence_penalty(presence_penaltySEXP);
+    Rcpp::traits::input_parameter< double >::type dry_multiplier(dry_multiplierSEXP);
+    Rcpp::traits::input_parameter< double >::type dry_base(dry_baseSEXP);
+    Rcpp::traits::input_parameter< int >::type dry_allowed_length(dry_allowed_lengthSEXP);
+    Rcpp::traits::input_parameter< int >::type dry_penalty_last_n(dry_penalty_last_nSEXP);
+    Rcpp::traits::input_parameter< double >::type seed(seedSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_sampler_internal(model_ptr, temperature, top_p, top_k, min_p, typical_p, repeat_penalty, penalty_last_n, frequency_penalty, presence_penalty, dry_multiplier, dry_base, dry_allowed_length, dry_penalty_last_n, seed));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_grammar_internal
+SEXP edge_grammar_internal(SEXP model_ptr, std::string grammar_str, std::string grammar_root);
+RcppExport SEXP _edgemodelr_edge_grammar_internal(SEXP model_ptrSEXP, SEXP grammar_strSEXP, SEXP grammar_rootSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    Rcpp::traits::input_parameter< std::string >::type grammar_str(grammar_strSEXP);
+    Rcpp::traits::input_parameter< std::string >::type grammar_root(grammar_rootSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_grammar_internal(model_ptr, grammar_str, grammar_root));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_grammar_mask_internal
+LogicalVector edge_grammar_mask_internal(SEXP grammar_ptr, IntegerVector accepted, int slice);
+RcppExport SEXP _edgemodelr_edge_grammar_mask_internal(SEXP grammar_ptrSEXP, SEXP acceptedSEXP, SEXP sliceSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type grammar_ptr(grammar_ptrSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type accepted(acceptedSEXP);
+    Rcpp::traits::input_parameter< int >::type slice(sliceSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_grammar_mask_internal(grammar_ptr, accepted, slice));
     return rcpp_result_gen;
 END_RCPP
 }
 // edge_completion_internal
-std::string edge_completion_internal(SEXP model_ptr, std::string prompt, int n_predict, double temperature, double top_p);
-RcppExport SEXP _edgemodelr_edge_completion_internal(SEXP model_ptrSEXP, SEXP promptSEXP, SEXP n_predictSEXP, SEXP temperatureSEXP, SEXP top_pSEXP) {
+std::string edge_completion_internal(SEXP model_ptr, std::string prompt, int n_predict, double temperature, double top_p, SEXP sampler_ptr, double timeout_seconds);
+RcppExport SEXP _edgemodelr_edge_completion_internal(SEXP model_ptrSEXP, SEXP promptSEXP, SEXP n_predictSEXP, SEXP temperatureSEXP, SEXP top_pSEXP, SEXP sampler_ptrSEXP, SEXP timeout_secondsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -68,7 +233,9 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< int >::type n_predict(n_predictSEXP);
     Rcpp::traits::input_parameter< double >::type temperature(temperatureSEXP);
     Rcpp::traits::input_parameter< double >::type top_p(top_pSEXP);
-    rcpp_result_gen = Rcpp::wrap(edge_completion_internal(model_ptr, prompt, n_predict, temperature, top_p));
+    Rcpp::traits::input_parameter< SEXP >::type sampler_ptr(sampler_ptrSEXP);
+    Rcpp::traits::input_parameter< double >::type timeout_seconds(timeout_secondsSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_completion_internal(model_ptr, prompt, n_predict, temperature, top_p, sampler_ptr, timeout_seconds));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -94,38 +261,151 @@ BEGIN_RCPP
 END_RCPP
 }
 // edge_completion_stream_internal
-List edge_completion_stream_internal(SEXP model_ptr, std::string prompt, Function callback, int n_predict, double temperature, double top_p);
-RcppExport SEXP _edgemodelr_edge_completion_stream_internal(SEXP model_ptrSEXP, SEXP promptSEXP, SEXP callbackSEXP, SEXP n_predictSEXP, SEXP temperatureSEXP, SEXP top_pSEXP) {
+List edge_completion_stream_internal(SEXP model_ptr, std::string prompt, SEXP callback, int n_predict, double temperature, double top_p, SEXP sampler_ptr, int chunk_tokens, double chunk_ms, std::string output_path, int output_fd, double timeout_seconds);
+RcppExport SEXP _edgemodelr_edge_completion_stream_internal(SEXP model_ptrSEXP, SEXP promptSEXP, SEXP callbackSEXP, SEXP n_predictSEXP, SEXP temperatureSEXP, SEXP top_pSEXP, SEXP sampler_ptrSEXP, SEXP chunk_tokensSEXP, SEXP chunk_msSEXP, SEXP output_pathSEXP, SEXP output_fdSEXP, SEXP timeout_secondsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
     Rcpp::traits::input_parameter< std::string >::type prompt(promptSEXP);
-    Rcpp::traits::input_parameter< Function >::type callback(callbackSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type callback(callbackSEXP);
     Rcpp::traits::input_parameter< int >::type n_predict(n_predictSEXP);
     Rcpp::traits::input_parameter< double >::type temperature(temperatureSEXP);
     Rcpp::traits::input_parameter< double >::type top_p(top_pSEXP);
-    rcpp_result_gen = Rcpp::wrap(edge_completion_stream_internal(model_ptr, prompt, callback, n_predict, temperature, top_p));
+    Rcpp::traits::input_parameter< SEXP >::type sampler_ptr(sampler_ptrSEXP);
+    Rcpp::traits::input_parameter< int >::type chunk_tokens(chunk_tokensSEXP);
+    Rcpp::traits::input_parameter< double >::type chunk_ms(chunk_msSEXP);
+    Rcpp::traits::input_parameter< std::string >::type output_path(output_pathSEXP);
+    Rcpp::traits::input_parameter< int >::type output_fd(output_fdSEXP);
+    Rcpp::traits::input_parameter< double >::type timeout_seconds(timeout_secondsSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_completion_stream_internal(model_ptr, prompt, callback, n_predict, temperature, top_p, sampler_ptr, chunk_tokens, chunk_ms, output_path, output_fd, timeout_seconds));
     return rcpp_result_gen;
 END_RCPP
 }
 // edge_completion_grammar_internal
-std::string edge_completion_grammar_internal(SEXP model_ptr, std::string prompt, std::string grammar_str, std::string grammar_root, int n_predict, double temperature, double top_p);
-RcppExport SEXP _edgemodelr_edge_completion_grammar_internal(SEXP model_ptrSEXP, SEXP promptSEXP, SEXP grammar_strSEXP, SEXP grammar_rootSEXP, SEXP n_predictSEXP, SEXP temperatureSEXP, SEXP top_pSEXP) {
+std::string edge_completion_grammar_internal(SEXP model_ptr, std::string prompt, SEXP grammar, std::string grammar_root, int n_predict, double temperature, double top_p, SEXP sampler_ptr, double timeout_seconds);
+RcppExport SEXP _edgemodelr_edge_completion_grammar_internal(SEXP model_ptrSEXP, SEXP promptSEXP, SEXP grammarSEXP, SEXP grammar_rootSEXP, SEXP n_predictSEXP, SEXP temperatureSEXP, SEXP top_pSEXP, SEXP sampler_ptrSEXP, SEXP timeout_secondsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
     Rcpp::traits::input_parameter< std::string >::type prompt(promptSEXP);
-    Rcpp::traits::input_parameter< std::string >::type grammar_str(grammar_strSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type grammar(grammarSEXP);
+    Rcpp::traits::input_parameter< std::string >::type grammar_root(grammar_rootSEXP);
+    Rcpp::traits::input_parameter< int >::type n_predict(n_predictSEXP);
+    Rcpp::traits::input_parameter< double >::type temperature(temperatureSEXP);
+    Rcpp::traits::input_parameter< double >::type top_p(top_pSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type sampler_ptr(sampler_ptrSEXP);
+    Rcpp::traits::input_parameter< double >::type timeout_seconds(timeout_secondsSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_completion_grammar_internal(model_ptr, prompt, grammar, grammar_root, n_predict, temperature, top_p, sampler_ptr, timeout_seconds));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_score_internal
+List edge_score_internal(SEXP model_ptr, std::string prompt, std::vector<std::string> continuations);
+RcppExport SEXP _edgemodelr_edge_score_internal(SEXP model_ptrSEXP, SEXP promptSEXP, SEXP continuationsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    Rcpp::traits::input_parameter< std::string >::type prompt(promptSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type continuations(continuationsSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_score_internal(model_ptr, prompt, continuations));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_completion_batch_internal
+CharacterVector edge_completion_batch_internal(SEXP model_ptr, std::vector<std::string> prompts, int n_predict, double temperature, double top_p, SEXP grammar, std::string grammar_root, int n_parallel);
+RcppExport SEXP _edgemodelr_edge_completion_batch_internal(SEXP model_ptrSEXP, SEXP promptsSEXP, SEXP n_predictSEXP, SEXP temperatureSEXP, SEXP top_pSEXP, SEXP grammarSEXP, SEXP grammar_rootSEXP, SEXP n_parallelSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type prompts(promptsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_predict(n_predictSEXP);
+    Rcpp::traits::input_parameter< double >::type temperature(temperatureSEXP);
+    Rcpp::traits::input_parameter< double >::type top_p(top_pSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type grammar(grammarSEXP);
     Rcpp::traits::input_parameter< std::string >::type grammar_root(grammar_rootSEXP);
+    Rcpp::traits::input_parameter< int >::type n_parallel(n_parallelSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_completion_batch_internal(model_ptr, prompts, n_predict, temperature, top_p, grammar, grammar_root, n_parallel));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_server_start_internal
+SEXP edge_server_start_internal(SEXP model_ptr, int n_parallel, int n_ctx_seq);
+RcppExport SEXP _edgemodelr_edge_server_start_internal(SEXP model_ptrSEXP, SEXP n_parallelSEXP, SEXP n_ctx_seqSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    Rcpp::traits::input_parameter< int >::type n_parallel(n_parallelSEXP);
+    Rcpp::traits::input_parameter< int >::type n_ctx_seq(n_ctx_seqSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_server_start_internal(model_ptr, n_parallel, n_ctx_seq));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_server_submit_internal
+double edge_server_submit_internal(SEXP server_ptr, std::string prompt, int n_predict, double temperature, double top_p, std::string grammar_str, std::string grammar_root);
+RcppExport SEXP _edgemodelr_edge_server_submit_internal(SEXP server_ptrSEXP, SEXP promptSEXP, SEXP n_predictSEXP, SEXP temperatureSEXP, SEXP top_pSEXP, SEXP grammar_strSEXP, SEXP grammar_rootSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type server_ptr(server_ptrSEXP);
+    Rcpp::traits::input_parameter< std::string >::type prompt(promptSEXP);
     Rcpp::traits::input_parameter< int >::type n_predict(n_predictSEXP);
     Rcpp::traits::input_parameter< double >::type temperature(temperatureSEXP);
     Rcpp::traits::input_parameter< double >::type top_p(top_pSEXP);
-    rcpp_result_gen = Rcpp::wrap(edge_completion_grammar_internal(model_ptr, prompt, grammar_str, grammar_root, n_predict, temperature, top_p));
+    Rcpp::traits::input_parameter< std::string >::type grammar_str(grammar_strSEXP);
+    Rcpp::traits::input_parameter< std::string >::type grammar_root(grammar_rootSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_server_submit_internal(server_ptr, prompt, n_predict, temperature, top_p, grammar_str, grammar_root));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_server_result_internal
+SEXP edge_server_result_internal(SEXP server_ptr, double id);
+RcppExport SEXP _edgemodelr_edge_server_result_internal(SEXP server_ptrSEXP, SEXP idSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type server_ptr(server_ptrSEXP);
+    Rcpp::traits::input_parameter< double >::type id(idSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_server_result_internal(server_ptr, id));
     return rcpp_result_gen;
 END_RCPP
 }
+// edge_server_cancel_internal
+void edge_server_cancel_internal(SEXP server_ptr, double id);
+RcppExport SEXP _edgemodelr_edge_server_cancel_internal(SEXP server_ptrSEXP, SEXP idSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type server_ptr(server_ptrSEXP);
+    Rcpp::traits::input_parameter< double >::type id(idSEXP);
+    edge_server_cancel_internal(server_ptr, id);
+    return R_NilValue;
+END_RCPP
+}
+// edge_server_stats_internal
+List edge_server_stats_internal(SEXP server_ptr);
+RcppExport SEXP _edgemodelr_edge_server_stats_internal(SEXP server_ptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type server_ptr(server_ptrSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_server_stats_internal(server_ptr));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_server_stop_internal
+void edge_server_stop_internal(SEXP server_ptr);
+RcppExport SEXP _edgemodelr_edge_server_stop_internal(SEXP server_ptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type server_ptr(server_ptrSEXP);
+    edge_server_stop_internal(server_ptr);
+    return R_NilValue;
+END_RCPP
+}
 // edge_embeddings_internal
 NumericMatrix edge_embeddings_internal(SEXP model_ptr, std::vector<std::string> texts, bool normalize);
 RcppExport SEXP _edgemodelr_edge_embeddings_internal(SEXP model_ptrSEXP, SEXP textsSEXP, SEXP normalizeSEXP) {
@@ -139,6 +419,115 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// edge_context_stats_internal
+List edge_context_stats_internal(SEXP model_ptr);
+RcppExport SEXP _edgemodelr_edge_context_stats_internal(SEXP model_ptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_context_stats_internal(model_ptr));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_speculative_internal
+void edge_speculative_internal(SEXP model_ptr, SEXP draft_ptr, int n_draft, int lookup_ngram);
+RcppExport SEXP _edgemodelr_edge_speculative_internal(SEXP model_ptrSEXP, SEXP draft_ptrSEXP, SEXP n_draftSEXP, SEXP lookup_ngramSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type draft_ptr(draft_ptrSEXP);
+    Rcpp::traits::input_parameter< int >::type n_draft(n_draftSEXP);
+    Rcpp::traits::input_parameter< int >::type lookup_ngram(lookup_ngramSEXP);
+    edge_speculative_internal(model_ptr, draft_ptr, n_draft, lookup_ngram);
+    return R_NilValue;
+END_RCPP
+}
+// edge_cancel_internal
+void edge_cancel_internal(SEXP model_ptr);
+RcppExport SEXP _edgemodelr_edge_cancel_internal(SEXP model_ptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    edge_cancel_internal(model_ptr);
+    return R_NilValue;
+END_RCPP
+}
+// edge_context_clear_internal
+void edge_context_clear_internal(SEXP model_ptr);
+RcppExport SEXP _edgemodelr_edge_context_clear_internal(SEXP model_ptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    edge_context_clear_internal(model_ptr);
+    return R_NilValue;
+END_RCPP
+}
+// edge_benchmark_internal
+DataFrame edge_benchmark_internal(SEXP model_ptr, std::vector<int> n_prompt, std::vector<int> n_gen, std::vector<int> n_batch, std::vector<int> n_threads, int repetitions, std::string prompt);
+RcppExport SEXP _edgemodelr_edge_benchmark_internal(SEXP model_ptrSEXP, SEXP n_promptSEXP, SEXP n_genSEXP, SEXP n_batchSEXP, SEXP n_threadsSEXP, SEXP repetitionsSEXP, SEXP promptSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type n_prompt(n_promptSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type n_gen(n_genSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type n_batch(n_batchSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< int >::type repetitions(repetitionsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type prompt(promptSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_benchmark_internal(model_ptr, n_prompt, n_gen, n_batch, n_threads, repetitions, prompt));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_profile_start_internal
+void edge_profile_start_internal(SEXP model_ptr, bool trace);
+RcppExport SEXP _edgemodelr_edge_profile_start_internal(SEXP model_ptrSEXP, SEXP traceSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    Rcpp::traits::input_parameter< bool >::type trace(traceSEXP);
+    edge_profile_start_internal(model_ptr, trace);
+    return R_NilValue;
+END_RCPP
+}
+// edge_profile_stop_internal
+DataFrame edge_profile_stop_internal(SEXP model_ptr, std::string trace_path);
+RcppExport SEXP _edgemodelr_edge_profile_stop_internal(SEXP model_ptrSEXP, SEXP trace_pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    Rcpp::traits::input_parameter< std::string >::type trace_path(trace_pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_profile_stop_internal(model_ptr, trace_path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_state_save_internal
+SEXP edge_state_save_internal(SEXP model_ptr, std::string path, std::string prompt);
+RcppExport SEXP _edgemodelr_edge_state_save_internal(SEXP model_ptrSEXP, SEXP pathSEXP, SEXP promptSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type prompt(promptSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_state_save_internal(model_ptr, path, prompt));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_state_load_internal
+int edge_state_load_internal(SEXP model_ptr, SEXP state);
+RcppExport SEXP _edgemodelr_edge_state_load_internal(SEXP model_ptrSEXP, SEXP stateSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type model_ptr(model_ptrSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type state(stateSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_state_load_internal(model_ptr, state));
+    return rcpp_result_gen;
+END_RCPP
+}
 // edge_model_n_embd_internal
 int edge_model_n_embd_internal(SEXP model_ptr);
 RcppExport SEXP _edgemodelr_edge_model_n_embd_internal(SEXP model_ptrSEXP) {
@@ -184,6 +573,28 @@ BEGIN_RCPP
     return R_NilValue;
 END_RCPP
 }
+// edge_numa_info_internal
+List edge_numa_info_internal();
+RcppExport SEXP _edgemodelr_edge_numa_info_internal() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(edge_numa_info_internal());
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_memory_bandwidth_internal
+DataFrame edge_memory_bandwidth_internal(double size_mb, int repeats);
+RcppExport SEXP _edgemodelr_edge_memory_bandwidth_internal(SEXP size_mbSEXP, SEXP repeatsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< double >::type size_mb(size_mbSEXP);
+    Rcpp::traits::input_parameter< int >::type repeats(repeatsSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_memory_bandwidth_internal(size_mb, repeats));
+    return rcpp_result_gen;
+END_RCPP
+}
 // edge_simd_info_internal
 Rcpp::List edge_simd_info_internal();
 RcppExport SEXP _edgemodelr_edge_simd_info_internal() {
@@ -194,23 +605,157 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// edge_vector_index_create_internal
+SEXP edge_vector_index_create_internal(int n_dim, std::string type);
+RcppExport SEXP _edgemodelr_edge_vector_index_create_internal(SEXP n_dimSEXP, SEXP typeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type n_dim(n_dimSEXP);
+    Rcpp::traits::input_parameter< std::string >::type type(typeSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_vector_index_create_internal(n_dim, type));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_vector_index_add_internal
+int edge_vector_index_add_internal(SEXP index_ptr, NumericMatrix embeddings);
+RcppExport SEXP _edgemodelr_edge_vector_index_add_internal(SEXP index_ptrSEXP, SEXP embeddingsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type index_ptr(index_ptrSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type embeddings(embeddingsSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_vector_index_add_internal(index_ptr, embeddings));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_vector_index_search_internal
+List edge_vector_index_search_internal(SEXP index_ptr, NumericVector query, int top_k);
+RcppExport SEXP _edgemodelr_edge_vector_index_search_internal(SEXP index_ptrSEXP, SEXP querySEXP, SEXP top_kSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type index_ptr(index_ptrSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type query(querySEXP);
+    Rcpp::traits::input_parameter< int >::type top_k(top_kSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_vector_index_search_internal(index_ptr, query, top_k));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_vector_index_info_internal
+List edge_vector_index_info_internal(SEXP index_ptr);
+RcppExport SEXP _edgemodelr_edge_vector_index_info_internal(SEXP index_ptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type index_ptr(index_ptrSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_vector_index_info_internal(index_ptr));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_vector_index_valid_internal
+bool edge_vector_index_valid_internal(SEXP index_ptr);
+RcppExport SEXP _edgemodelr_edge_vector_index_valid_internal(SEXP index_ptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type index_ptr(index_ptrSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_vector_index_valid_internal(index_ptr));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_vector_index_save_internal
+void edge_vector_index_save_internal(SEXP index_ptr, std::string path, std::vector<std::string> chunks, IntegerVector source_ids, std::vector<std::string> sources);
+RcppExport SEXP _edgemodelr_edge_vector_index_save_internal(SEXP index_ptrSEXP, SEXP pathSEXP, SEXP chunksSEXP, SEXP source_idsSEXP, SEXP sourcesSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type index_ptr(index_ptrSEXP);
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type chunks(chunksSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type source_ids(source_idsSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type sources(sourcesSEXP);
+    edge_vector_index_save_internal(index_ptr, path, chunks, source_ids, sources);
+    return R_NilValue;
+END_RCPP
+}
+// edge_vector_index_open_internal
+SEXP edge_vector_index_open_internal(std::string path);
+RcppExport SEXP _edgemodelr_edge_vector_index_open_internal(SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_vector_index_open_internal(path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// edge_vector_index_rows_internal
+List edge_vector_index_rows_internal(SEXP index_ptr, IntegerVector rows);
+RcppExport SEXP _edgemodelr_edge_vector_index_rows_internal(SEXP index_ptrSEXP, SEXP rowsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type index_ptr(index_ptrSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type rows(rowsSEXP);
+    rcpp_result_gen = Rcpp::wrap(edge_vector_index_rows_internal(index_ptr, rows));
+    return rcpp_result_gen;
+END_RCPP
+}
 
 static const R_CallMethodDef CallEntries[] = {
     {"_edgemodelr_edge_use_cuda_backend_internal", (DL_FUNC) &_edgemodelr_edge_use_cuda_backend_internal, 1},
     {"_edgemodelr_edge_cuda_backend_path_internal", (DL_FUNC) &_edgemodelr_edge_cuda_backend_path_internal, 0},
     {"_edgemodelr_edge_cuda_backend_loaded_internal", (DL_FUNC) &_edgemodelr_edge_cuda_backend_loaded_internal, 0},
-    {"_edgemodelr_edge_load_model_internal", (DL_FUNC) &_edgemodelr_edge_load_model_internal, 6},
-    {"_edgemodelr_edge_completion_internal", (DL_FUNC) &_edgemodelr_edge_completion_internal, 5},
+    {"_edgemodelr_edge_load_model_internal", (DL_FUNC) &_edgemodelr_edge_load_model_internal, 16},
+    {"_edgemodelr_edge_load_weights_internal", (DL_FUNC) &_edgemodelr_edge_load_weights_internal, 3},
+    {"_edgemodelr_edge_new_context_internal", (DL_FUNC) &_edgemodelr_edge_new_context_internal, 14},
+    {"_edgemodelr_edge_weights_info_internal", (DL_FUNC) &_edgemodelr_edge_weights_info_internal, 1},
+    {"_edgemodelr_edge_free_weights_internal", (DL_FUNC) &_edgemodelr_edge_free_weights_internal, 1},
+    {"_edgemodelr_edge_keep_warm_internal", (DL_FUNC) &_edgemodelr_edge_keep_warm_internal, 1},
+    {"_edgemodelr_edge_model_resident_internal", (DL_FUNC) &_edgemodelr_edge_model_resident_internal, 2},
+    {"_edgemodelr_edge_resident_models_internal", (DL_FUNC) &_edgemodelr_edge_resident_models_internal, 0},
+    {"_edgemodelr_edge_set_threads_internal", (DL_FUNC) &_edgemodelr_edge_set_threads_internal, 3},
+    {"_edgemodelr_edge_sampler_internal", (DL_FUNC) &_edgemodelr_edge_sampler_internal, 15},
+    {"_edgemodelr_edge_grammar_internal", (DL_FUNC) &_edgemodelr_edge_grammar_internal, 3},
+    {"_edgemodelr_edge_grammar_mask_internal", (DL_FUNC) &_edgemodelr_edge_grammar_mask_internal, 3},
+    {"_edgemodelr_edge_completion_internal", (DL_FUNC) &_edgemodelr_edge_completion_internal, 7},
     {"_edgemodelr_edge_free_model_internal", (DL_FUNC) &_edgemodelr_edge_free_model_internal, 1},
     {"_edgemodelr_is_valid_model_internal", (DL_FUNC) &_edgemodelr_is_valid_model_internal, 1},
-    {"_edgemodelr_edge_completion_stream_internal", (DL_FUNC) &_edgemodelr_edge_completion_stream_internal, 6},
-    {"_edgemodelr_edge_completion_grammar_internal", (DL_FUNC) &_edgemodelr_edge_completion_grammar_internal, 7},
+    {"_edgemodelr_edge_completion_stream_internal", (DL_FUNC) &_edgemodelr_edge_completion_stream_internal, 12},
+    {"_edgemodelr_edge_completion_grammar_internal", (DL_FUNC) &_edgemodelr_edge_completion_grammar_internal, 9},
+    {"_edgemodelr_edge_score_internal", (DL_FUNC) &_edgemodelr_edge_score_internal, 3},
+    {"_edgemodelr_edge_completion_batch_internal", (DL_FUNC) &_edgemodelr_edge_completion_batch_internal, 8},
+    {"_edgemodelr_edge_server_start_internal", (DL_FUNC) &_edgemodelr_edge_server_start_internal, 3},
+    {"_edgemodelr_edge_server_submit_internal", (DL_FUNC) &_edgemodelr_edge_server_submit_internal, 7},
+    {"_edgemodelr_edge_server_result_internal", (DL_FUNC) &_edgemodelr_edge_server_result_internal, 2},
+    {"_edgemodelr_edge_server_cancel_internal", (DL_FUNC) &_edgemodelr_edge_server_cancel_internal, 2},
+    {"_edgemodelr_edge_server_stats_internal", (DL_FUNC) &_edgemodelr_edge_server_stats_internal, 1},
+    {"_edgemodelr_edge_server_stop_internal", (DL_FUNC) &_edgemodelr_edge_server_stop_internal, 1},
     {"_edgemodelr_edge_embeddings_internal", (DL_FUNC) &_edgemodelr_edge_embeddings_internal, 3},
+    {"_edgemodelr_edge_context_stats_internal", (DL_FUNC) &_edgemodelr_edge_context_stats_internal, 1},
+    {"_edgemodelr_edge_speculative_internal", (DL_FUNC) &_edgemodelr_edge_speculative_internal, 4},
+    {"_edgemodelr_edge_cancel_internal", (DL_FUNC) &_edgemodelr_edge_cancel_internal, 1},
+    {"_edgemodelr_edge_context_clear_internal", (DL_FUNC) &_edgemodelr_edge_context_clear_internal, 1},
+    {"_edgemodelr_edge_benchmark_internal", (DL_FUNC) &_edgemodelr_edge_benchmark_internal, 7},
+    {"_edgemodelr_edge_profile_start_internal", (DL_FUNC) &_edgemodelr_edge_profile_start_internal, 2},
+    {"_edgemodelr_edge_profile_stop_internal", (DL_FUNC) &_edgemodelr_edge_profile_stop_internal, 2},
+    {"_edgemodelr_edge_state_save_internal", (DL_FUNC) &_edgemodelr_edge_state_save_internal, 3},
+    {"_edgemodelr_edge_state_load_internal", (DL_FUNC) &_edgemodelr_edge_state_load_internal, 2},
     {"_edgemodelr_edge_model_n_embd_internal", (DL_FUNC) &_edgemodelr_edge_model_n_embd_internal, 1},
     {"_edgemodelr_edge_chat_apply_template_internal", (DL_FUNC) &_edgemodelr_edge_chat_apply_template_internal, 3},
     {"_edgemodelr_edge_model_chat_template_internal", (DL_FUNC) &_edgemodelr_edge_model_chat_template_internal, 1},
     {"_edgemodelr_set_llama_logging", (DL_FUNC) &_edgemodelr_set_llama_logging, 1},
+    {"_edgemodelr_edge_numa_info_internal", (DL_FUNC) &_edgemodelr_edge_numa_info_internal, 0},
+    {"_edgemodelr_edge_memory_bandwidth_internal", (DL_FUNC) &_edgemodelr_edge_memory_bandwidth_internal, 2},
     {"_edgemodelr_edge_simd_info_internal", (DL_FUNC) &_edgemodelr_edge_simd_info_internal, 0},
+    {"_edgemodelr_edge_vector_index_create_internal", (DL_FUNC) &_edgemodelr_edge_vector_index_create_internal, 2},
+    {"_edgemodelr_edge_vector_index_add_internal", (DL_FUNC) &_edgemodelr_edge_vector_index_add_internal, 2},
+    {"_edgemodelr_edge_vector_index_search_internal", (DL_FUNC) &_edgemodelr_edge_vector_index_search_internal, 3},
+    {"_edgemodelr_edge_vector_index_info_internal", (DL_FUNC) &_edgemodelr_edge_vector_index_info_internal, 1},
+    {"_edgemodelr_edge_vector_index_valid_internal", (DL_FUNC) &_edgemodelr_edge_vector_index_valid_internal, 1},
+    {"_edgemodelr_edge_vector_index_save_internal", (DL_FUNC) &_edgemodelr_edge_vector_index_save_internal, 5},
+    {"_edgemodelr_edge_vector_index_open_internal", (DL_FUNC) &_edgemodelr_edge_vector_index_open_internal, 1},
+    {"_edgemodelr_edge_vector_index_rows_internal", (DL_FUNC) &_edgemodelr_edge_vector_index_rows_internal, 2},
     {NULL, NULL, 0}
 };
 
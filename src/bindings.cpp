@@ -1,12 +1,38 @@
 // Main bindings file - should compile cleanly
 
 #include <Rcpp.h>
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <set>
+#include <chrono>
+#include <cctype>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <random>
+#include <tuple>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
 
 #include "llama.h"
 #include "ggml-backend.h"
@@ -21,6 +47,12 @@ extern "C" {
   ggml_backend_reg_t ggml_backend_cpu_reg(void);
 }
 
+// NUMA strategy for the session, see numa.cpp
+void edge_numa_apply(int strategy);
+
+// Bytes allocated for a context's KV cache, see kv_cache_size.cpp
+double edge_kv_cache_bytes(const llama_context* ctx);
+
 using namespace Rcpp;
 
 // Global variable to control logging
@@ -36,10 +68,15 @@ static std::string g_cuda_backend_path;
 // Tracks whether the CUDA backend DLL was successfully loaded by ggml_backend_load()
 static bool g_cuda_backend_loaded = false;
 
+// The thread R runs on; llama.cpp may also log from the native server thread,
+// which must never call into R
+static const std::thread::id g_r_thread = std::this_thread::get_id();
+
 // Custom log callback to suppress output
 void quiet_log_callback(ggml_log_level level, const char * text, void * user_data) {
   // Only output critical errors using R's error system, suppress all other output
-  if (g_logging_enabled && level >= GGML_LOG_LEVEL_ERROR) {
+  if (g_logging_enabled && level >= GGML_LOG_LEVEL_ERROR &&
+      std::this_thread::get_id() == g_r_thread) {
     // Use R's warning system instead of direct stderr output
     Rcpp::warning(std::string("llama.cpp error: ") + text);
   }
@@ -96,10 +133,232 @@ bool edge_cuda_backend_loaded_internal() {
   return g_cuda_backend_loaded;
 }
 
+struct EdgeServer;
+static void edge_server_shutdown(EdgeServer* server);
+static void edge_grammar_cache_evict(const llama_vocab* vocab);
+
+// Identifies loaded weights in the model registry: the same file, unchanged
+// since it was loaded, with the same GPU offload
+struct EdgeModelKey {
+  std::string path;     // canonical path
+  double size = -1;     // file size in bytes, negative when not registered
+  double mtime = 0;     // modification time, seconds since the epoch
+  int n_gpu_layers = 0;
+
+  bool operator<(const EdgeModelKey& other) const {
+    return std::tie(path, size, mtime, n_gpu_layers) <
+           std::tie(other.path, other.size, other.mtime, other.n_gpu_layers);
+  }
+};
+
+// Loaded model weights, shared by every context created from them and freed
+// (or kept warm by the registry) with the last reference
+struct EdgeModel {
+  struct llama_model* model = NULL;
+  std::string path;
+  EdgeModelKey key;
+
+  EdgeModel() = default;
+  EdgeModel(const EdgeModel&) = delete;
+  EdgeModel& operator=(const EdgeModel&) = delete;
+
+  ~EdgeModel() {
+    if (model) {
+      edge_grammar_cache_evict(llama_model_get_vocab(model));
+      llama_model_free(model);
+    }
+  }
+};
+typedef std::shared_ptr<EdgeModel> EdgeModelRef;
+
+// Per-op profile of the graphs a context computes (edge_profile()). The
+// scheduler's eval callback is installed only on contexts created with
+// profile = TRUE, since it splits every graph into single-node computes.
+// Until `enabled` it asks for no nodes; then each node runs and is timed on
+// its own.
+struct EdgeProfiler {
+  struct Stat {
+    int64_t calls = 0;
+    int64_t time_ns = 0;
+    double flops = 0.0;
+    double bytes = 0.0;
+  };
+  struct Event {
+    const char* op;
+    std::string tensor;
+    int layer;
+    int64_t start_ns;
+    int64_t dur_ns;
+  };
+
+  bool enabled = false;
+  bool trace = false;
+  std::chrono::steady_clock::time_point t_begin;
+  std::chrono::steady_clock::time_point t_node;
+  std::map<std::pair<std::string, int>, Stat> stats;
+  std::vector<Event> events;
+
+  void start(bool with_trace) {
+    stats.clear();
+    events.clear();
+    trace = with_trace;
+    t_begin = std::chrono::steady_clock::now();
+    enabled = true;
+  }
+};
+
+// Layer of a tensor named by llama.cpp's graph builder ("ffn_up-12",
+// "Kcur-3 (view)"), or -1 for tensors outside the layers
+static int edge_tensor_layer(const char* name) {
+  const char* end = strchr(name, ' ');
+  if (!end) end = name + strlen(name);
+  const char* p = end;
+  while (p > name && isdigit((unsigned char)p[-1])) --p;
+  if (p == end || p == name || p[-1] != '-') return -1;
+  return atoi(p);
+}
+
+// Floating-point operations of a node: multiply-adds for the matrix products
+// and attention, one per output element for everything else
+static double edge_tensor_flops(const ggml_tensor* t) {
+  switch (t->op) {
+    case GGML_OP_MUL_MAT:
+    case GGML_OP_MUL_MAT_ID:
+      return 2.0 * t->src[0]->ne[0] * ggml_nelements(t);
+    case GGML_OP_FLASH_ATTN_EXT: {
+      const ggml_tensor* q = t->src[0];
+      const ggml_tensor* k = t->src[1];
+      const ggml_tensor* v = t->src[2];
+      return 2.0 * q->ne[1] * q->ne[2] * q->ne[3] * k->ne[1] * (k->ne[0] + v->ne[0]);
+    }
+    default:
+      return (double)ggml_nelements(t);
+  }
+}
+
+// Bytes a node reads and writes. Row lookups and expert matrix products read
+// only the rows or experts they select, not their whole first operand.
+static double edge_tensor_bytes(const ggml_tensor* t) {
+  double bytes = (double)ggml_nbytes(t);
+  for (int i = 0; i < GGML_MAX_SRC && t->src[i]; ++i) {
+    const ggml_tensor* src = t->src[i];
+    if (i == 0 && t->op == GGML_OP_GET_ROWS) {
+      bytes += (double)ggml_row_size(src->type, src->ne[0]) * ggml_nrows(t);
+    } else if (i == 0 && t->op == GGML_OP_MUL_MAT_ID) {
+      const ggml_tensor* ids = t->src[2];
+      bytes += std::min((double)ggml_nbytes(src),
+                        (double)ggml_nbytes(src) / src->ne[2] * ids->ne[0] * ids->ne[1]);
+    } else {
+      bytes += (double)ggml_nbytes(src);
+    }
+  }
+  return bytes;
+}
+
+// ggml_backend_sched eval callback: asked whether a node is wanted before it
+// is computed, then called with it once its range of nodes has finished
+static bool edge_profile_eval(struct ggml_tensor* t, bool ask, void* user_data) {
+  EdgeProfiler* profiler = static_cast<EdgeProfiler*>(user_data);
+  if (!profiler->enabled) {
+    return false;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  if (ask) {
+    profiler->t_node = now;
+    return true;
+  }
+  switch (t->op) {
+    case GGML_OP_NONE: case GGML_OP_VIEW: case GGML_OP_RESHAPE:
+    case GGML_OP_PERMUTE: case GGML_OP_TRANSPOSE:
+      return true;  // views compute nothing
+    default:
+      break;
+  }
+
+  const int64_t dur = std::chrono::duration_cast<std::chrono::nanoseconds>(now - profiler->t_node).count();
+  const int layer = edge_tensor_layer(ggml_get_name(t));
+  EdgeProfiler::Stat& stat = profiler->stats[std::make_pair(std::string(ggml_op_desc(t)), layer)];
+  stat.calls++;
+  stat.time_ns += dur;
+  stat.flops += edge_tensor_flops(t);
+  stat.bytes += edge_tensor_bytes(t);
+  if (profiler->trace) {
+    const int64_t start = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      profiler->t_node - profiler->t_begin).count();
+    profiler->events.push_back({ggml_op_desc(t), ggml_get_name(t), layer, start, dur});
+  }
+  return true;
+}
+
 struct EdgeModelContext {
   struct llama_model* model = NULL;
   struct llama_context* ctx = NULL;
 
+  // Keeps `model` alive while this context uses it
+  EdgeModelRef model_ref;
+
+  // Parameters the context was created with, reused for auxiliary contexts
+  llama_context_params ctx_params = llama_context_default_params();
+
+  // Multi-sequence context for batched generation, created on first use
+  struct llama_context* batch_ctx = NULL;
+
+  // Multi-sequence context for packed embedding extraction, created on first use
+  struct llama_context* embd_ctx = NULL;
+
+  // Multi-sequence context for scoring continuations, created on first use.
+  // Sequence 0 keeps the last scored prompt so a shared prefix is reused.
+  struct llama_context* score_ctx = NULL;
+  std::vector<llama_token> score_tokens;
+
+  // Persistent CPU threadpools for token generation and for prompt batches,
+  // attached to the main and auxiliary contexts. threadpool_batch is NULL
+  // when both use the same settings and share `threadpool`.
+  ggml_threadpool_t threadpool = NULL;
+  ggml_threadpool_t threadpool_batch = NULL;
+  int threadpool_size = 0;        // threads in the generation pool
+  int threadpool_batch_size = 0;  // threads used for batches
+
+  // Native server running on this model, if any. It owns its own context and
+  // is shut down before the model is freed.
+  EdgeServer* server = NULL;
+
+  // Tokens currently held in the KV cache for sequence 0, in position order.
+  // Lets the next prompt skip re-decoding the prefix it shares with them.
+  std::vector<llama_token> cached_tokens;
+
+  // Speculative decoding (edge_speculative()): a smaller model with the
+  // same vocabulary, or with lookup_ngram > 0 the sequence itself, drafts up
+  // to n_draft tokens, which this context then checks in one decode. The
+  // draft's handle is kept alive through this context's external pointer.
+  EdgeModelContext* draft = NULL;
+  int n_draft = 0;
+  int lookup_ngram = 0;
+
+  // Statistics from the most recent generation call
+  int last_prompt_tokens = 0;
+  int last_reused_tokens = 0;
+  int last_generated_tokens = 0;
+  int last_draft_tokens = 0;
+  int last_accepted_tokens = 0;
+  std::string last_finish_reason;
+
+  // Why the running call should stop early (an EdgeStop value), or
+  // EDGE_STOP_NONE. edge_cancel() may set it from an R callback or from
+  // another thread; generation loops check it between tokens and the abort
+  // callback inside llama_decode(). While a call runs on the R thread
+  // (EdgeCallScope), the abort callback also sets it for user interrupts
+  // and for the call's deadline.
+  std::atomic<int> stop_reason{0};
+  bool on_r_thread = false;
+  bool has_deadline = false;
+  std::chrono::steady_clock::time_point deadline;
+  std::chrono::steady_clock::time_point next_interrupt_poll;
+
+  // Receives the main context's eval callback, for contexts created with
+  // profile = TRUE; see edge_profile()
+  std::unique_ptr<EdgeProfiler> profiler;
+
   EdgeModelContext() = default;
 
   // Copy constructor and assignment deleted to prevent double-free
@@ -111,14 +370,42 @@ struct EdgeModelContext {
   }
 
   void cleanup() {
+    if (server) {
+      edge_server_shutdown(server);
+    }
+    cached_tokens.clear();
+    draft = NULL;
+    n_draft = 0;
+    lookup_ngram = 0;
+    if (batch_ctx) {
+      llama_free(batch_ctx);
+      batch_ctx = NULL;
+    }
+    if (embd_ctx) {
+      llama_free(embd_ctx);
+      embd_ctx = NULL;
+    }
+    score_tokens.clear();
+    if (score_ctx) {
+      llama_free(score_ctx);
+      score_ctx = NULL;
+    }
     if (ctx) {
       llama_free(ctx);
       ctx = NULL;
     }
-    if (model) {
-      llama_model_free(model);
-      model = NULL;
+    // Only once no context can run a graph on them
+    if (threadpool_batch) {
+      ggml_threadpool_free(threadpool_batch);
+      threadpool_batch = NULL;
     }
+    if (threadpool) {
+      ggml_threadpool_free(threadpool);
+      threadpool = NULL;
+    }
+    // Frees the model unless another context or handle still uses it
+    model_ref.reset();
+    model = NULL;
   }
 
   bool is_valid() const {
@@ -137,422 +424,2218 @@ struct EdgeModelContext {
   }
 };
 
-// [[Rcpp::export]]
-SEXP edge_load_model_internal(std::string model_path, int n_ctx = 2048, int n_gpu_layers = 0, int n_threads = 0, bool flash_attn = true, bool embeddings = false) {
-  try {
-    // Ensure llama is properly initialized
-    ensure_llama_initialized();
-    
-    llama_model_params model_params = llama_model_default_params();
-    model_params.n_gpu_layers = n_gpu_layers;
-
-    struct llama_model* model = llama_model_load_from_file(model_path.c_str(), model_params);
-    if (!model) {
-      // Check if file exists
-      std::ifstream file(model_path);
-      if (!file.good()) {
-        stop("Model file does not exist or is not readable: " + model_path);
-      }
-
-      // Enhanced diagnostics for GGUF files
-      std::string diagnostic_msg = "Failed to load GGUF model from: " + model_path +
-                                   ". The file exists but llama.cpp cannot parse it.\n";
-
-      // Check if it looks like a GGUF file
-      file.seekg(0);
-      char magic[4];
-      if (file.read(magic, 4) && std::string(magic, 4) == "GGUF") {
-        diagnostic_msg += "File has valid GGUF magic header. Possible issues:\n";
-        diagnostic_msg += "- Incompatible GGUF version (try a different llama.cpp version)\n";
-        diagnostic_msg += "- Model architecture not supported\n";
-        diagnostic_msg += "- File corruption during download\n";
-        diagnostic_msg += "- Insufficient memory (try smaller n_ctx or n_gpu_layers=0)\n";
-      } else {
-        diagnostic_msg += "File does not have GGUF magic header. This is not a valid GGUF file.\n";
-        diagnostic_msg += "For Ollama models, ensure you're using the correct blob file path.\n";
-      }
+enum EdgeStop { EDGE_STOP_NONE = 0, EDGE_STOP_CANCELLED, EDGE_STOP_TIMEOUT, EDGE_STOP_INTERRUPTED };
 
-      stop(diagnostic_msg);
-    }
-    
-    llama_context_params ctx_params = llama_context_default_params();
-    ctx_params.n_ctx = n_ctx;
-
-    // Adaptive batch size optimization for small models
-    // Small models benefit from larger batches relative to context size
-    int optimal_batch;
-    if (n_ctx <= 512) {
-      optimal_batch = std::min(512, n_ctx);  // Very small context: use up to full context
-    } else if (n_ctx <= 2048) {
-      optimal_batch = std::min(512, n_ctx / 2);  // Small models: use 1/2 context
-    } else if (n_ctx <= 4096) {
-      optimal_batch = std::min(1024, n_ctx / 4);  // Medium models: use 1/4 context
-    } else {
-      optimal_batch = std::min(2048, n_ctx / 4);  // Large context: cap at 2048
-    }
-    ctx_params.n_batch = optimal_batch;
-
-    // Thread configuration: use all hardware threads by default, allow user override
-    int hardware_threads = std::max(1, (int)std::thread::hardware_concurrency());
-    int effective_threads = (n_threads > 0) ? std::min(n_threads, hardware_threads) : hardware_threads;
-    ctx_params.n_threads = effective_threads;
-    ctx_params.n_threads_batch = hardware_threads;  // batch processing always benefits from max threads
-    // flash_attn was a bool in older llama.cpp; b8179 changed to an enum
-    ctx_params.flash_attn_type = flash_attn
-      ? LLAMA_FLASH_ATTN_TYPE_ENABLED
-      : LLAMA_FLASH_ATTN_TYPE_DISABLED;
-    ctx_params.embeddings = embeddings;
-    
-    struct llama_context* ctx = llama_init_from_model(model, ctx_params);
-    if (!ctx) {
-      llama_model_free(model);
-      stop("Failed to create context for model");
-    }
-    
-    auto edge_ctx = std::make_unique<EdgeModelContext>();
-    edge_ctx->model = model;
-    edge_ctx->ctx = ctx;
-    
-    XPtr<EdgeModelContext> ptr(edge_ctx.release(), true);
-    ptr.attr("class") = "edge_model_context";
-    
-    return ptr;
-  } catch (const std::exception& e) {
-    stop("Error loading model: " + std::string(e.what()));
+static const char* edge_stop_name(int reason) {
+  switch (reason) {
+    case EDGE_STOP_CANCELLED: return "cancelled";
+    case EDGE_STOP_TIMEOUT: return "timeout";
+    case EDGE_STOP_INTERRUPTED: return "interrupted";
+    default: return "";
   }
 }
 
-// [[Rcpp::export]]
-std::string edge_completion_internal(SEXP model_ptr, std::string prompt, int n_predict = 128, double temperature = 0.8, double top_p = 0.95) {
-  try {
-    if (TYPEOF(model_ptr) != EXTPTRSXP) {
-      stop("Invalid model context");
-    }
+// How often a call on the R thread looks for a user interrupt. Each check
+// runs R's event loop, so not on every graph node.
+static const std::chrono::milliseconds EDGE_INTERRUPT_POLL(100);
 
-    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+static void edge_check_interrupt(void*) {
+  R_CheckUserInterrupt();
+}
 
-    if (!edge_ctx->is_valid() || edge_ctx->ctx == nullptr || edge_ctx->model == nullptr) {
-      stop("Invalid model context or null pointers");
+// Abort callback of the contexts used on the R thread. ggml calls it between
+// graph nodes on the thread that called llama_decode(), and the generation
+// loops between tokens. Returns true once the call should stop; a decode
+// stopped this way returns 2 and leaves the KV cache as it was before the
+// aborted micro-batch.
+static bool edge_abort_callback(void* data) {
+  EdgeModelContext* edge_ctx = static_cast<EdgeModelContext*>(data);
+  if (edge_ctx->stop_reason.load(std::memory_order_relaxed) != EDGE_STOP_NONE) {
+    return true;
+  }
+  if (!edge_ctx->on_r_thread) {
+    return false;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  if (edge_ctx->has_deadline && now >= edge_ctx->deadline) {
+    edge_ctx->stop_reason = EDGE_STOP_TIMEOUT;
+    return true;
+  }
+  if (now >= edge_ctx->next_interrupt_poll) {
+    edge_ctx->next_interrupt_poll = now + EDGE_INTERRUPT_POLL;
+    // R_CheckUserInterrupt() would jump out of ggml; run it where R can
+    // unwind and raise the interrupt again once the call has cleaned up
+    if (!R_ToplevelExec(edge_check_interrupt, NULL)) {
+      edge_ctx->stop_reason = EDGE_STOP_INTERRUPTED;
+      return true;
     }
+  }
+  return false;
+}
 
-    // Validate input parameters
-    if (n_predict <= 0) {
-      stop("n_predict must be positive");
-    }
-    if (temperature < 0.0 || temperature > 2.0) {
-      stop("Temperature must be between 0.0 and 2.0");
-    }
-    if (top_p <= 0.0 || top_p > 1.0) {
-      stop("top_p must be between 0.0 and 1.0");
+// A call running on the R thread. Clears the stop request of the previous
+// call, sets the optional deadline, and lets the abort callback look for
+// user interrupts until the call returns.
+struct EdgeCallScope {
+  EdgeModelContext* edge_ctx;
+
+  explicit EdgeCallScope(EdgeModelContext* edge_ctx_, double timeout_seconds = 0) : edge_ctx(edge_ctx_) {
+    const auto now = std::chrono::steady_clock::now();
+    edge_ctx->stop_reason = EDGE_STOP_NONE;
+    edge_ctx->on_r_thread = true;
+    edge_ctx->next_interrupt_poll = now + EDGE_INTERRUPT_POLL;
+    edge_ctx->has_deadline = timeout_seconds > 0;
+    if (edge_ctx->has_deadline) {
+      edge_ctx->deadline = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(timeout_seconds));
     }
+  }
 
-    // Get vocabulary from model
-    const struct llama_vocab* vocab = llama_model_get_vocab(edge_ctx->model);
-    if (!vocab) {
-      stop("Failed to get vocabulary from model");
+  ~EdgeCallScope() {
+    edge_ctx->on_r_thread = false;
+    edge_ctx->has_deadline = false;
+  }
+
+  EdgeCallScope(const EdgeCallScope&) = delete;
+  EdgeCallScope& operator=(const EdgeCallScope&) = delete;
+
+  // Raise the user interrupt the call stopped for. Call once everything the
+  // call allocated has been released.
+  void rethrow_interrupt() const {
+    if (edge_ctx->stop_reason == EDGE_STOP_INTERRUPTED) {
+      throw Rcpp::internal::InterruptedException();
     }
-    
-    // Tokenize the prompt - first get the number of tokens needed
-    const int n_prompt_tokens = -llama_tokenize(vocab, prompt.c_str(), (int32_t)prompt.size(), NULL, 0, true, true);
-    
-    if (n_prompt_tokens <= 0) {
-      stop("Failed to determine prompt token count");
+  }
+};
+
+// Give up on a call whose decode the abort callback stopped: a user
+// interrupt is raised again, a cancel or timeout becomes an error.
+[[noreturn]] static void edge_throw_stopped(EdgeModelContext* edge_ctx) {
+  const int reason = edge_ctx->stop_reason;
+  if (reason == EDGE_STOP_INTERRUPTED) {
+    throw Rcpp::internal::InterruptedException();
+  }
+  throw std::runtime_error(std::string("Stopped early: ") + edge_stop_name(reason));
+}
+
+// Decode `prompt_tokens` into sequence 0, reusing the longest prefix already
+// in the KV cache. Everything after the shared prefix is dropped from the
+// cache and only the remaining suffix is decoded, in n_batch sized chunks.
+// At least the last prompt token is always decoded so its logits are
+// available for sampling. Sets `n_past` to the number of reused tokens and
+// returns the result of the last llama_decode(). When the decode is stopped
+// by the abort callback (2) or fails, the cache keeps what was decoded so
+// far. Leaves the call statistics alone.
+static int edge_decode_cached(EdgeModelContext* edge_ctx, const std::vector<llama_token>& prompt_tokens, size_t& n_past) {
+  llama_context* ctx = edge_ctx->ctx;
+  std::vector<llama_token>& cached = edge_ctx->cached_tokens;
+
+  n_past = 0;
+  const size_t n_common = std::min(cached.size(), prompt_tokens.size());
+  while (n_past < n_common && cached[n_past] == prompt_tokens[n_past]) {
+    n_past++;
+  }
+  if (n_past == prompt_tokens.size()) {
+    n_past--;
+  }
+
+  llama_memory_t mem = llama_get_memory(ctx);
+  if (mem && !llama_memory_seq_rm(mem, 0, (llama_pos)n_past, -1)) {
+    // Some memory types (e.g. recurrent) cannot drop a partial range
+    llama_memory_clear(mem, true);
+    n_past = 0;
+  }
+  cached.resize(n_past);
+
+  const size_t n_batch = std::max<uint32_t>(1, llama_n_batch(ctx));
+  for (size_t i = n_past; i < prompt_tokens.size(); i += n_batch) {
+    const size_t n_eval = std::min(n_batch, prompt_tokens.size() - i);
+    llama_batch batch = llama_batch_get_one(const_cast<llama_token*>(prompt_tokens.data()) + i, (int32_t)n_eval);
+    const int rc = llama_decode(ctx, batch);
+    if (rc == 2) {
+      // Aborted: earlier micro-batches of this chunk stay in the cache
+      const llama_pos pos_max = mem ? llama_memory_seq_pos_max(mem, 0) : -1;
+      cached.insert(cached.end(), prompt_tokens.begin() + i, prompt_tokens.begin() + i + n_eval);
+      cached.resize(std::min(cached.size(), (size_t)(pos_max + 1)));
+      return rc;
     }
-    
-    // Allocate space for tokens and tokenize
-    std::vector<llama_token> prompt_tokens(n_prompt_tokens);
-    if (llama_tokenize(vocab, prompt.c_str(), (int32_t)prompt.size(), prompt_tokens.data(), (int32_t)prompt_tokens.size(), true, true) < 0) {
-      stop("Failed to tokenize prompt");
+    if (rc) {
+      return rc;
     }
+    cached.insert(cached.end(), prompt_tokens.begin() + i, prompt_tokens.begin() + i + n_eval);
+  }
+  return 0;
+}
 
-    // Validate prompt fits in context window
-    int n_ctx = llama_n_ctx(edge_ctx->ctx);
-    if (n_prompt_tokens >= n_ctx) {
-      stop("Prompt too long (" + std::to_string(n_prompt_tokens) + " tokens) for context size (" +
-           std::to_string(n_ctx) + "). Shorten the prompt or increase n_ctx in edge_load_model().");
-    }
+// Decode a prompt with edge_decode_cached() and record it in the call
+// statistics. Returns the number of reused tokens. When the decode is
+// stopped by the abort callback, the caller finds the reason in stop_reason.
+static int edge_decode_prompt(EdgeModelContext* edge_ctx, const std::vector<llama_token>& prompt_tokens) {
+  size_t n_past = 0;
+  const int rc = edge_decode_cached(edge_ctx, prompt_tokens, n_past);
+  if (rc != 0 && rc != 2) {
+    stop("Failed to process prompt");
+  }
 
-    // Create initial batch for the prompt
-    llama_batch batch = llama_batch_get_one(prompt_tokens.data(), (int32_t)prompt_tokens.size());
+  edge_ctx->last_prompt_tokens = (int)prompt_tokens.size();
+  edge_ctx->last_reused_tokens = (int)n_past;
+  edge_ctx->last_generated_tokens = 0;
+  return (int)n_past;
+}
 
-    // Process the prompt
-    if (llama_decode(edge_ctx->ctx, batch)) {
-      stop("Failed to process prompt");
-    }
+// Decode one token and record it as part of the cached sequence
+static bool edge_decode_next(EdgeModelContext* edge_ctx, llama_token token) {
+  llama_batch batch = llama_batch_get_one(&token, 1);
+  if (llama_decode(edge_ctx->ctx, batch)) {
+    return false;
+  }
+  edge_ctx->cached_tokens.push_back(token);
+  return true;
+}
 
-    std::string result;  // Only collect generated text, not prompt
-    result.reserve(n_predict * 8);
-    
-    // Create a sampler chain for better token generation
-    auto sampler_chain_params = llama_sampler_chain_default_params();
-    auto * sampler = llama_sampler_chain_init(sampler_chain_params);
+// Decode one sampled token and count it as generated
+static bool edge_decode_token(EdgeModelContext* edge_ctx, llama_token token) {
+  if (!edge_decode_next(edge_ctx, token)) {
+    return false;
+  }
+  edge_ctx->last_generated_tokens++;
+  return true;
+}
 
-    // Add samplers in the right order for quality generation
-    if (top_p < 1.0f) {
-      llama_sampler_chain_add(sampler, llama_sampler_init_top_p(static_cast<float>(top_p), 1));
-    }
-    if (temperature > 0.0f) {
-      llama_sampler_chain_add(sampler, llama_sampler_init_temp(static_cast<float>(temperature)));
-    }
-    llama_sampler_chain_add(sampler, llama_sampler_init_dist(12345)); // Random seed
+// Decode a sampled token followed by the `draft` tokens proposed to come
+// after it, with logits for every position, and record them as part of the
+// cached sequence. Logits row j then holds the prediction after token j.
+static bool edge_decode_draft(EdgeModelContext* edge_ctx, llama_token token, const std::vector<llama_token>& draft) {
+  std::vector<llama_token> tokens;
+  tokens.reserve(draft.size() + 1);
+  tokens.push_back(token);
+  tokens.insert(tokens.end(), draft.begin(), draft.end());
+  std::vector<int8_t> logits(tokens.size(), 1);
+
+  llama_batch batch = llama_batch_get_one(tokens.data(), (int32_t)tokens.size());
+  batch.logits = logits.data();
+  if (llama_decode(edge_ctx->ctx, batch)) {
+    return false;
+  }
+  edge_ctx->cached_tokens.insert(edge_ctx->cached_tokens.end(), tokens.begin(), tokens.end());
+  return true;
+}
 
-    // Generate tokens using the new sampler API
-    for (int i = 0; i < n_predict; ++i) {
-      // Sample next token using the sampler chain
-      llama_token new_token = llama_sampler_sample(sampler, edge_ctx->ctx, -1);
-      
-      // Check if it's end of generation
-      if (llama_vocab_is_eog(vocab, new_token)) {
-        break;
-      }
-      
-      // Convert token to text with dynamic buffer allocation
-      std::vector<char> piece(512);  // Start with larger buffer
-      int n_chars = llama_token_to_piece(vocab, new_token, piece.data(), static_cast<int32_t>(piece.size()), 0, true);
+// Remove the last `n` tokens, drafted but not accepted, from the cache
+static void edge_drop_draft(EdgeModelContext* edge_ctx, size_t n) {
+  std::vector<llama_token>& cached = edge_ctx->cached_tokens;
+  if (!llama_memory_seq_rm(llama_get_memory(edge_ctx->ctx), 0, (llama_pos)(cached.size() - n), -1)) {
+    stop("Failed to remove rejected draft tokens from the cache");
+  }
+  cached.resize(cached.size() - n);
+}
 
-      // If buffer too small, resize and retry
-      if (n_chars < 0) {
-        piece.resize(static_cast<size_t>(std::abs(n_chars)) + 1);  // +1 for null terminator
-        n_chars = llama_token_to_piece(vocab, new_token, piece.data(), static_cast<int32_t>(piece.size()), 0, true);
-      }
+// Speculation rolls rejected drafts back with llama_memory_seq_rm. Recurrent
+// and hybrid models keep a running state that cannot drop a partial range,
+// so the rejected tokens would stay in it and change the output.
+static bool edge_can_drop_draft(const llama_model* model) {
+  return !llama_model_is_recurrent(model) && !llama_model_is_hybrid(model);
+}
 
-      if (n_chars > 0) {
-        result.append(piece.data(), n_chars);
-      } else if (n_chars < 0) {
-        // If still failing, log warning and skip this token
-        warning("Failed to convert token to text, skipping token");
-        continue;
-      }
-      
-      // Accept the token for sampling history
-      llama_sampler_accept(sampler, new_token);
+// Points the draft context's abort callback at the target for the duration
+// of a draft step, so drafting stops with the target's call: on
+// edge_cancel(), its timeout or a user interrupt. The draft's own stop
+// request, left over from an earlier call on it, does not apply.
+struct EdgeDraftScope {
+  EdgeModelContext* draft;
 
-      // Prepare next batch with the new token
-      batch = llama_batch_get_one(&new_token, 1);
+  EdgeDraftScope(EdgeModelContext* draft_, EdgeModelContext* target) : draft(draft_) {
+    llama_set_abort_callback(draft->ctx, edge_abort_callback, target);
+  }
 
-      // Process the new token
-      if (llama_decode(edge_ctx->ctx, batch)) {
-        break;
+  ~EdgeDraftScope() {
+    llama_set_abort_callback(draft->ctx, edge_abort_callback, draft);
+  }
+
+  EdgeDraftScope(const EdgeDraftScope&) = delete;
+  EdgeDraftScope& operator=(const EdgeDraftScope&) = delete;
+};
+
+// Let the draft model propose up to n_max tokens to follow the cached
+// sequence and `token`. The draft keeps its own prompt cache, so each call
+// only decodes what changed since the last one: usually the token that
+// replaced a rejected draft. Drafting is greedy and stops at end of
+// generation; a draft decode that fails or is stopped ends it early. The
+// draft handle's statistics are left alone.
+static void edge_draft_propose(EdgeModelContext* edge_ctx, llama_token token, int n_max, std::vector<llama_token>& out) {
+  EdgeModelContext* draft = edge_ctx->draft;
+  std::vector<llama_token> history;
+  history.reserve(edge_ctx->cached_tokens.size() + 1);
+  history.assign(edge_ctx->cached_tokens.begin(), edge_ctx->cached_tokens.end());
+  history.push_back(token);
+  if (history.size() + n_max >= llama_n_ctx(draft->ctx)) {
+    return;  // the draft's context is full
+  }
+
+  EdgeDraftScope scope(draft, edge_ctx);
+  size_t n_past = 0;
+  if (edge_decode_cached(draft, history, n_past) != 0) {
+    return;
+  }
+  const llama_vocab* vocab = llama_model_get_vocab(draft->model);
+  const int n_vocab = llama_vocab_n_tokens(vocab);
+  const int n_vocab_target = llama_vocab_n_tokens(llama_model_get_vocab(edge_ctx->model));
+  for (int j = 0; j < n_max; ++j) {
+    const float* logits = llama_get_logits_ith(draft->ctx, -1);
+    if (!logits) {
+      break;
+    }
+    llama_token best = 0;
+    for (llama_token t = 1; t < n_vocab; ++t) {
+      if (logits[t] > logits[best]) {
+        best = t;
       }
     }
+    if (best >= n_vocab_target || llama_vocab_is_eog(vocab, best)) {
+      break;
+    }
+    out.push_back(best);
+    if (j + 1 < n_max && !edge_decode_next(draft, best)) {
+      break;
+    }
+  }
+}
 
-    // Clean up sampler
-    llama_sampler_free(sampler);
-
-    return result;
-    
-  } catch (const std::exception& e) {
-    stop("Error during completion: " + std::string(e.what()));
+// Append the text piece of `token` to `out`. The piece is written straight
+// into the string's spare capacity, so no temporary buffer is allocated;
+// only pieces longer than the first guess need a second call.
+static void edge_append_piece(const llama_vocab* vocab, llama_token token, std::string& out) {
+  const size_t n_old = out.size();
+  out.resize(n_old + 32);
+  int n_chars = llama_token_to_piece(vocab, token, &out[n_old], 32, 0, true);
+  if (n_chars < 0) {
+    out.resize(n_old + static_cast<size_t>(-n_chars));
+    n_chars = llama_token_to_piece(vocab, token, &out[n_old], -n_chars, 0, true);
   }
+  out.resize(n_old + std::max(n_chars, 0));
 }
 
-// [[Rcpp::export]]
-void edge_free_model_internal(SEXP model_ptr) {
-  try {
-    if (TYPEOF(model_ptr) != EXTPTRSXP) {
-      warning("Invalid model pointer type");
-      return;
+// Length of the longest prefix of `text` that does not end inside a UTF-8
+// sequence. Byte-level vocabularies can split one character over several
+// tokens, so freshly generated text may end with an incomplete sequence.
+static size_t edge_utf8_complete_len(const std::string& text) {
+  const size_t n = text.size();
+  for (size_t i = 1; i <= 4 && i <= n; ++i) {
+    const unsigned char c = static_cast<unsigned char>(text[n - i]);
+    if ((c & 0xC0) == 0x80) {
+      continue;  // continuation byte, keep looking for the lead byte
     }
+    const size_t len = (c & 0x80) == 0x00 ? 1 :
+                       (c & 0xE0) == 0xC0 ? 2 :
+                       (c & 0xF0) == 0xE0 ? 3 :
+                       (c & 0xF8) == 0xF0 ? 4 : 1;
+    return len > i ? n - i : n;
+  }
+  return n;
+}
 
-    XPtr<EdgeModelContext> edge_ctx(model_ptr);
-    if (edge_ctx.get() != nullptr) {
-      edge_ctx->cleanup();
-    }
+// Tokenize a prompt for single-sequence generation and check that it
+// leaves room in the context for at least one generated token.
+static std::vector<llama_token> edge_tokenize_prompt(const llama_vocab* vocab, const std::string& prompt, int n_ctx) {
+  const int n_prompt_tokens = -llama_tokenize(vocab, prompt.c_str(), (int32_t)prompt.size(), NULL, 0, true, true);
+  if (n_prompt_tokens <= 0) {
+    stop("Failed to determine prompt token count");
+  }
 
-  } catch (const std::exception& e) {
-    warning("Error freeing model: " + std::string(e.what()));
+  std::vector<llama_token> prompt_tokens(n_prompt_tokens);
+  if (llama_tokenize(vocab, prompt.c_str(), (int32_t)prompt.size(), prompt_tokens.data(), (int32_t)prompt_tokens.size(), true, true) < 0) {
+    stop("Failed to tokenize prompt");
   }
-}
 
-// [[Rcpp::export]]
-bool is_valid_model_internal(SEXP model_ptr) {
-  try {
-    XPtr<EdgeModelContext> edge_ctx(model_ptr);
-    return edge_ctx->is_valid();
-  } catch (...) {
-    return false;
+  if (n_prompt_tokens >= n_ctx) {
+    stop("Prompt too long (" + std::to_string(n_prompt_tokens) + " tokens) for context size (" +
+         std::to_string(n_ctx) + "). Shorten the prompt or increase n_ctx in edge_load_model().");
   }
+  return prompt_tokens;
 }
 
-// [[Rcpp::export]]
-List edge_completion_stream_internal(SEXP model_ptr, std::string prompt, Function callback, int n_predict = 128, double temperature = 0.8, double top_p = 0.95) {
-  try {
-    if (TYPEOF(model_ptr) != EXTPTRSXP) {
-      stop("Invalid model context");
-    }
-    
-    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+// Outcome of edge_generate()
+struct EdgeGenerateResult {
+  int n_tokens = 0;
+  // "stop", "length", "callback", "error", or the stop reason of the call:
+  // "cancelled", "timeout" or "interrupted"
+  std::string finish_reason;
+};
 
-    if (!edge_ctx->is_valid() || edge_ctx->ctx == nullptr || edge_ctx->model == nullptr) {
-      stop("Invalid model context or null pointers");
+// Prompt lookup drafting: where each n-gram of the sequence last occurred.
+// When the sequence ends in an n-gram seen before, the tokens that followed
+// it then are proposed as the draft. Generated text that copies spans of
+// the prompt (extracted values, quotes) is drafted without a second model.
+struct EdgeNgramIndex {
+  size_t n;
+  size_t n_indexed = 0;  // n-grams starting before this position are indexed
+  std::unordered_map<uint64_t, size_t> next;  // n-gram hash -> position after its last occurrence
+
+  explicit EdgeNgramIndex(int n_) : n((size_t)n_) {}
+
+  uint64_t key(const std::vector<llama_token>& seq, size_t start) const {
+    uint64_t h = 1469598103934665603ull;
+    for (size_t k = 0; k < n; ++k) {
+      h = (h ^ (uint32_t)seq[start + k]) * 1099511628211ull;
     }
+    return h;
+  }
 
-    // Validate input parameters
-    if (n_predict <= 0) {
-      stop("n_predict must be positive");
+  // Propose up to n_max tokens to follow `seq`. The index only grows, so
+  // `seq` must extend the sequence of the previous call.
+  void propose(const std::vector<llama_token>& seq, int n_max, std::vector<llama_token>& out) {
+    const size_t len = seq.size();
+    if (len <= n) {
+      return;
     }
-    if (temperature < 0.0 || temperature > 2.0) {
-      stop("Temperature must be between 0.0 and 2.0");
+    // Index every n-gram except the final one, which is looked up
+    for (; n_indexed + n < len; ++n_indexed) {
+      next[key(seq, n_indexed)] = n_indexed + n;
     }
-    if (top_p <= 0.0 || top_p > 1.0) {
-      stop("top_p must be between 0.0 and 1.0");
+    auto it = next.find(key(seq, len - n));
+    if (it == next.end() || !std::equal(seq.end() - n, seq.end(), seq.begin() + (it->second - n))) {
+      return;
     }
+    for (size_t p = it->second; p < len && (int)out.size() < n_max; ++p) {
+      out.push_back(seq[p]);
+    }
+  }
+};
 
-    // Get vocabulary from model
-    const struct llama_vocab* vocab = llama_model_get_vocab(edge_ctx->model);
-    if (!vocab) {
-      stop("Failed to get vocabulary from model");
+// Generation loop shared by the single-sequence completion functions. The
+// prompt must already be in the KV cache (edge_decode_prompt()). Samples up
+// to n_predict tokens and appends their text to `out`. Whenever `out` gains
+// complete UTF-8 characters, on_text(begin, length, n_tokens) is called with
+// them; returning false stops generation. An incomplete character left at
+// the end is dropped.
+//
+// With speculative decoding, every decode also carries the tokens drafted
+// by the draft model or by prompt lookup. Each token is still sampled by
+// `sampler`, from the logits after the previous one; while it equals the
+// next drafted token, that token is already in the cache and the following
+// logits are ready, so several tokens come out of one decode. The first
+// mismatch drops the rest of the draft from the cache. The output is the
+// same as without drafting.
+template <typename F>
+static EdgeGenerateResult edge_generate(EdgeModelContext* edge_ctx, const llama_vocab* vocab,
+                                        llama_sampler* sampler, int n_predict, std::string& out, F on_text) {
+  EdgeGenerateResult res;
+  res.finish_reason = "length";
+
+  const size_t n_ctx = llama_n_ctx(edge_ctx->ctx);
+  size_t n_emitted = out.size();
+
+  const bool speculate = edge_ctx->n_draft > 0 &&
+                         (edge_ctx->lookup_ngram > 0 || (edge_ctx->draft && edge_ctx->draft->is_valid()));
+  std::unique_ptr<EdgeNgramIndex> lookup;
+  if (speculate && edge_ctx->lookup_ngram > 0) {
+    lookup.reset(new EdgeNgramIndex(edge_ctx->lookup_ngram));
+  }
+  std::vector<llama_token> draft;  // drafted tokens in the cache, after the last decoded token
+  size_t n_verified = 0;           // of which were accepted so far
+  int row = -1;                    // logits row the next token is sampled from
+  edge_ctx->last_draft_tokens = 0;
+  edge_ctx->last_accepted_tokens = 0;
+
+  for (int i = 0; i < n_predict; ++i) {
+    // Also covers a prompt decode that was stopped, whose logits are unusable
+    if (edge_abort_callback(edge_ctx)) {
+      res.finish_reason = edge_stop_name(edge_ctx->stop_reason);
+      break;
     }
 
-    // Tokenize the prompt - first get the number of tokens needed
-    const int n_prompt_tokens = -llama_tokenize(vocab, prompt.c_str(), (int32_t)prompt.size(), NULL, 0, true, true);
-    
-    if (n_prompt_tokens <= 0) {
-      stop("Failed to determine prompt token count");
+    // llama_sampler_sample() also accepts the token into the chain
+    const llama_token new_token = llama_sampler_sample(sampler, edge_ctx->ctx, row);
+    bool in_cache = false;
+    if (n_verified < draft.size()) {
+      if (new_token == draft[n_verified]) {
+        in_cache = true;
+        n_verified++;
+        row++;
+        edge_ctx->last_accepted_tokens++;
+      } else {
+        edge_drop_draft(edge_ctx, draft.size() - n_verified);
+        draft.clear();
+        n_verified = 0;
+      }
     }
-    
-    // Allocate space for tokens and tokenize
-    std::vector<llama_token> prompt_tokens(n_prompt_tokens);
-    if (llama_tokenize(vocab, prompt.c_str(), (int32_t)prompt.size(), prompt_tokens.data(), (int32_t)prompt_tokens.size(), true, true) < 0) {
-      stop("Failed to tokenize prompt");
+    if (llama_vocab_is_eog(vocab, new_token)) {
+      res.finish_reason = "stop";
+      break;
     }
 
-    // Validate prompt fits in context window
-    int n_ctx = llama_n_ctx(edge_ctx->ctx);
-    if (n_prompt_tokens >= n_ctx) {
-      stop("Prompt too long (" + std::to_string(n_prompt_tokens) + " tokens) for context size (" +
-           std::to_string(n_ctx) + "). Shorten the prompt or increase n_ctx in edge_load_model().");
-    }
+    edge_append_piece(vocab, new_token, out);
+    res.n_tokens++;
 
-    // Create initial batch for the prompt
-    llama_batch batch = llama_batch_get_one(prompt_tokens.data(), (int32_t)prompt_tokens.size());
+    const size_t n_complete = edge_utf8_complete_len(out);
+    if (n_complete > n_emitted) {
+      const bool keep_going = on_text(out.data() + n_emitted, n_complete - n_emitted, res.n_tokens);
+      n_emitted = n_complete;
+      if (!keep_going) {
+        res.finish_reason = "callback";
+        break;
+      }
+    }
 
-    // Process the prompt
-    if (llama_decode(edge_ctx->ctx, batch)) {
-      stop("Failed to process prompt");
+    if (i + 1 == n_predict) {
+      break;  // the last token's logits are never used
+    }
+    if (in_cache) {
+      continue;  // accepted draft token, its logits are ready
+    }
+    if (edge_ctx->cached_tokens.size() + 1 >= n_ctx) {
+      break;  // context is full
     }
 
-    std::string full_response;  // Track generated text only
-    std::vector<std::string> tokens_generated;
-    int tokens_count = 0;
-    bool stopped_early = false;
+    // Draft only tokens that would be decoded anyway
+    draft.clear();
+    n_verified = 0;
+    if (speculate) {
+      const int n_max = std::min<int>({edge_ctx->n_draft, n_predict - i - 2,
+                                       (int)(n_ctx - edge_ctx->cached_tokens.size()) - 2});
+      if (n_max > 0 && lookup) {
+        std::vector<llama_token>& cached = edge_ctx->cached_tokens;
+        cached.push_back(new_token);
+        lookup->propose(cached, n_max, draft);
+        cached.pop_back();
+      } else if (n_max > 0) {
+        edge_draft_propose(edge_ctx, new_token, n_max, draft);
+      }
+    }
+    const bool decoded = draft.empty() ? edge_decode_token(edge_ctx, new_token)
+                                       : edge_decode_draft(edge_ctx, new_token, draft);
+    if (!decoded) {
+      draft.clear();
+      const int reason = edge_ctx->stop_reason;
+      res.finish_reason = reason != EDGE_STOP_NONE ? edge_stop_name(reason) : "error";
+      break;
+    }
+    edge_ctx->last_draft_tokens += (int)draft.size();
+    row = draft.empty() ? -1 : 0;
+  }
+  if (n_verified < draft.size()) {
+    edge_drop_draft(edge_ctx, draft.size() - n_verified);
+  }
 
-    // Create sampler chain for streaming
-    auto sampler_chain_params = llama_sampler_chain_default_params();
-    auto * sampler = llama_sampler_chain_init(sampler_chain_params);
+  out.resize(edge_utf8_complete_len(out));
+  edge_ctx->last_generated_tokens = res.n_tokens;
+  edge_ctx->last_finish_reason = res.finish_reason;
+  return res;
+}
 
-    // Add samplers for quality generation
-    if (top_p < 1.0f) {
-      llama_sampler_chain_add(sampler, llama_sampler_init_top_p(static_cast<float>(top_p), 1));
+// A GBNF grammar parsed once for one vocabulary. `tmpl` is a grammar sampler
+// in its initial state that is never sampled from; each generation call gets
+// a copy of it (llama_sampler_clone copies the parsed rules and stacks)
+// instead of parsing the text again. `tmpl` points into the vocabulary of
+// `model`, so a grammar is only used while those weights are loaded; the
+// cache drops it when they are freed, but an edge_grammar() handle may
+// outlive them.
+struct EdgeGrammar {
+  llama_sampler* tmpl = NULL;
+  const llama_vocab* vocab = NULL;
+  std::weak_ptr<EdgeModel> model;
+  std::string text;
+  std::string root;
+
+  EdgeGrammar() = default;
+  EdgeGrammar(const EdgeGrammar&) = delete;
+  EdgeGrammar& operator=(const EdgeGrammar&) = delete;
+
+  ~EdgeGrammar() {
+    if (tmpl) {
+      llama_sampler_free(tmpl);
     }
-    if (temperature > 0.0f) {
-      llama_sampler_chain_add(sampler, llama_sampler_init_temp(static_cast<float>(temperature)));
+  }
+};
+
+typedef std::shared_ptr<EdgeGrammar> EdgeGrammarRef;
+
+// Recently parsed grammars, most recently used first, keyed by vocabulary,
+// root rule and GBNF text. The least recently used one is dropped when full.
+static const size_t EDGE_GRAMMAR_CACHE_SIZE = 32;
+static std::mutex g_grammar_cache_mutex;
+static std::list<EdgeGrammarRef> g_grammar_cache;
+
+// Return the parsed grammar for `text` over the vocabulary of `model`, from
+// the cache when it was parsed before. Returns NULL if the grammar fails to
+// parse.
+static EdgeGrammarRef edge_compile_grammar(const EdgeModelRef& model, const std::string& text, const std::string& root) {
+  const llama_vocab* vocab = llama_model_get_vocab(model->model);
+  std::lock_guard<std::mutex> lock(g_grammar_cache_mutex);
+
+  for (auto it = g_grammar_cache.begin(); it != g_grammar_cache.end(); ++it) {
+    const EdgeGrammar& g = **it;
+    if (g.vocab == vocab && g.root == root && g.text == text) {
+      g_grammar_cache.splice(g_grammar_cache.begin(), g_grammar_cache, it);
+      return g_grammar_cache.front();
     }
-    llama_sampler_chain_add(sampler, llama_sampler_init_dist(12345)); // Random seed
+  }
 
-    // Generate tokens one by one and stream them with proper sampling
-    for (int i = 0; i < n_predict; ++i) {
-      // Sample next token using the sampler chain
-      llama_token new_token = llama_sampler_sample(sampler, edge_ctx->ctx, -1);
-      
-      // Check if it's end of generation
-      if (llama_vocab_is_eog(vocab, new_token)) {
-        stopped_early = true;
-        break;
-      }
-      
-      // Convert token to text with dynamic buffer allocation
-      std::vector<char> piece(512);  // Start with larger buffer
-      int n_chars = llama_token_to_piece(vocab, new_token, piece.data(), static_cast<int32_t>(piece.size()), 0, true);
-
-      // If buffer too small, resize and retry
-      if (n_chars < 0) {
-        piece.resize(static_cast<size_t>(std::abs(n_chars)) + 1);  // +1 for null terminator
-        n_chars = llama_token_to_piece(vocab, new_token, piece.data(), static_cast<int32_t>(piece.size()), 0, true);
-      }
-
-      std::string token_text = "";
-      if (n_chars > 0) {
-        token_text = std::string(piece.data(), n_chars);
-        full_response += token_text;
-        tokens_generated.push_back(token_text);
-        tokens_count++;
-        
-        // Call the R callback function with current token
-        try {
-          List callback_data = List::create(
-            Named("token") = token_text,
-            Named("position") = i + 1,
-            Named("is_final") = false,
-            Named("total_tokens") = tokens_count
-          );
-          
-          SEXP result = callback(callback_data);
-          
-          // Check if callback wants to stop early
-          if (is<LogicalVector>(result)) {
-            LogicalVector stop_signal = as<LogicalVector>(result);
-            if (stop_signal.length() > 0 && stop_signal[0] == false) {
-              stopped_early = true;
-              break;
-            }
-          }
-        } catch (const std::exception& e) {
-          warning("Callback error: " + std::string(e.what()));
-        }
-      } else if (n_chars < 0) {
-        // If still failing, log warning and skip this token
-        warning("Failed to convert token to text, skipping token");
-        continue;
-      }
+  llama_sampler* tmpl = llama_sampler_init_grammar(vocab, text.c_str(), root.c_str());
+  if (!tmpl) {
+    return EdgeGrammarRef();
+  }
+  EdgeGrammarRef grammar = std::make_shared<EdgeGrammar>();
+  grammar->tmpl = tmpl;
+  grammar->vocab = vocab;
+  grammar->model = model;
+  grammar->text = text;
+  grammar->root = root;
+
+  g_grammar_cache.push_front(grammar);
+  if (g_grammar_cache.size() > EDGE_GRAMMAR_CACHE_SIZE) {
+    g_grammar_cache.pop_back();
+  }
+  return grammar;
+}
 
-      // Accept the token for sampling history
-      llama_sampler_accept(sampler, new_token);
+// Drop the cached grammars of a vocabulary that is being freed
+static void edge_grammar_cache_evict(const llama_vocab* vocab) {
+  std::lock_guard<std::mutex> lock(g_grammar_cache_mutex);
+  g_grammar_cache.remove_if([vocab](const EdgeGrammarRef& g) { return g->vocab == vocab; });
+}
 
-      // Prepare next batch with the new token
-      batch = llama_batch_get_one(&new_token, 1);
+// The grammar of an edge_grammar() handle. Stops once the weights it was
+// compiled for have been freed: its vocabulary is gone with them.
+static EdgeGrammarRef edge_grammar_handle(SEXP grammar) {
+  XPtr<EdgeGrammarRef> ref(grammar);
+  if (ref.get() == nullptr || !*ref) {
+    stop("Invalid grammar");
+  }
+  if ((*ref)->model.expired()) {
+    stop("Invalid grammar: the model it was compiled for has been freed");
+  }
+  return *ref;
+}
 
-      // Process the new token
-      if (llama_decode(edge_ctx->ctx, batch)) {
-        stopped_early = true;
-        break;
-      }
+// Resolve the grammar argument of the generation functions: a handle from
+// edge_grammar(), or GBNF text (empty for none) parsed through the cache
+static EdgeGrammarRef edge_resolve_grammar(SEXP grammar, const std::string& grammar_root, const EdgeModelRef& model) {
+  if (TYPEOF(grammar) == EXTPTRSXP) {
+    EdgeGrammarRef handle = edge_grammar_handle(grammar);
+    if (handle->model.lock() != model) {
+      stop("grammar was compiled for a different model");
     }
-    
-    // Send final callback
-    try {
-      List final_callback_data = List::create(
-        Named("token") = "",
-        Named("position") = tokens_count,
-        Named("is_final") = true,
-        Named("total_tokens") = tokens_count,
-        Named("full_response") = full_response,
-        Named("stopped_early") = stopped_early
-      );
-      callback(final_callback_data);
-    } catch (const std::exception& e) {
-      warning("Final callback error: " + std::string(e.what()));
-    }
-
-    // Clean up sampler
-    llama_sampler_free(sampler);
+    return handle;
+  }
+
+  if (TYPEOF(grammar) != STRSXP || Rf_xlength(grammar) != 1) {
+    stop("grammar must be a GBNF string or created with edge_grammar()");
+  }
+  const std::string text = as<std::string>(grammar);
+  if (text.empty()) {
+    return EdgeGrammarRef();
+  }
+  EdgeGrammarRef compiled = edge_compile_grammar(model, text, grammar_root);
+  if (!compiled) {
+    stop("Failed to parse GBNF grammar. Check grammar syntax.");
+  }
+  return compiled;
+}
+
+// Build the sampler chain shared by the generation functions, starting with
+// a fresh copy of `grammar` if there is one.
+static llama_sampler* edge_make_sampler(const EdgeGrammar* grammar, double temperature, double top_p) {
+  auto sampler_chain_params = llama_sampler_chain_default_params();
+  auto * sampler = llama_sampler_chain_init(sampler_chain_params);
+
+  if (grammar) {
+    llama_sampler_chain_add(sampler, llama_sampler_clone(grammar->tmpl));
+  }
+  if (top_p < 1.0f) {
+    llama_sampler_chain_add(sampler, llama_sampler_init_top_p(static_cast<float>(top_p), 1));
+  }
+  if (temperature > 0.0f) {
+    llama_sampler_chain_add(sampler, llama_sampler_init_temp(static_cast<float>(temperature)));
+    llama_sampler_chain_add(sampler, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+  } else {
+    llama_sampler_chain_add(sampler, llama_sampler_init_greedy());
+  }
+  return sampler;
+}
+
+// Sampler chain built once by edge_sampler() and reused across calls. It is
+// reset before every use, which restarts the penalty/DRY history and draws a
+// fresh random seed (or restarts the fixed one). Its DRY sequence breakers
+// are token ids of `model`, which the handle does not keep loaded.
+struct EdgeSamplerConfig {
+  llama_sampler* chain = NULL;
+  std::weak_ptr<EdgeModel> model;
+
+  EdgeSamplerConfig() = default;
+  EdgeSamplerConfig(const EdgeSamplerConfig&) = delete;
+  EdgeSamplerConfig& operator=(const EdgeSamplerConfig&) = delete;
+
+  ~EdgeSamplerConfig() {
+    if (chain) {
+      llama_sampler_free(chain);
+    }
+  }
+};
+
+// Return the sampler for one generation call: the chain of `sampler_ptr` if
+// one was given, else a new chain from temperature/top_p. A grammar is put in
+// front of the configured chain in a separate chain that copies its samplers.
+// `owned` tells the caller whether it owns, and must free, the result.
+static llama_sampler* edge_acquire_sampler(SEXP sampler_ptr, const EdgeModelRef& model, const EdgeGrammar* grammar,
+                                           double temperature, double top_p, bool& owned) {
+  if (Rf_isNull(sampler_ptr)) {
+    owned = true;
+    return edge_make_sampler(grammar, temperature, top_p);
+  }
+
+  if (TYPEOF(sampler_ptr) != EXTPTRSXP) {
+    stop("sampler must be created with edge_sampler()");
+  }
+  XPtr<EdgeSamplerConfig> config(sampler_ptr);
+  if (config.get() == nullptr || config->chain == nullptr) {
+    stop("Invalid sampler");
+  }
+  if (config->model.expired()) {
+    stop("Invalid sampler: the model it was created for has been freed");
+  }
+  if (config->model.lock() != model) {
+    stop("sampler was created for a different model");
+  }
+
+  llama_sampler_reset(config->chain);
+  if (!grammar) {
+    owned = false;
+    return config->chain;
+  }
+
+  auto * sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
+  llama_sampler_chain_add(sampler, llama_sampler_clone(grammar->tmpl));
+  for (int i = 0; i < llama_sampler_chain_n(config->chain); ++i) {
+    llama_sampler_chain_add(sampler, llama_sampler_clone(llama_sampler_chain_get(config->chain, i)));
+  }
+  owned = true;
+  return sampler;
+}
+
+// Attach the model's threadpools and its abort callback to one of its
+// contexts. Only contexts used from the R thread share them: a pool runs one
+// graph at a time.
+static void edge_attach_threadpools(EdgeModelContext* edge_ctx, llama_context* ctx) {
+  if (ctx && edge_ctx->threadpool) {
+    llama_attach_threadpool(ctx, edge_ctx->threadpool, edge_ctx->threadpool_batch);
+  }
+  if (ctx) {
+    llama_set_abort_callback(ctx, edge_abort_callback, edge_ctx);
+  }
+}
+
+// Create a context sharing the model that holds `n_seq` sequences of up to
+// `n_ctx_seq` tokens each. Returns NULL on failure.
+static llama_context* edge_new_seq_context(EdgeModelContext* edge_ctx, int n_seq, int n_ctx_seq) {
+  // Each sequence gets its own KV stream (kv_unified = false): the prompts do
+  // not share a prefix, and llama.cpp pads the per-sequence size to 256.
+  llama_context_params params = edge_ctx->ctx_params;
+  params.n_ctx = (uint32_t)n_seq * (((uint32_t)n_ctx_seq + 255) / 256 * 256);
+  params.n_seq_max = n_seq;
+  params.kv_unified = false;
+  params.embeddings = false;
+  params.n_batch = std::max<uint32_t>(params.n_batch, n_seq);
+
+  return llama_init_from_model(edge_ctx->model, params);
+}
+
+// Return the model's batch context, able to hold `n_seq` sequences of up to
+// `n_ctx_seq` tokens each. The context is kept between calls and only
+// recreated when a larger one is needed.
+static llama_context* edge_get_batch_context(EdgeModelContext* edge_ctx, int n_seq, int n_ctx_seq) {
+  if (edge_ctx->batch_ctx &&
+      llama_n_seq_max(edge_ctx->batch_ctx) >= (uint32_t)n_seq &&
+      llama_n_ctx_seq(edge_ctx->batch_ctx) >= (uint32_t)n_ctx_seq) {
+    return edge_ctx->batch_ctx;
+  }
+  if (edge_ctx->batch_ctx) {
+    llama_free(edge_ctx->batch_ctx);
+    edge_ctx->batch_ctx = NULL;
+  }
+
+  edge_ctx->batch_ctx = edge_new_seq_context(edge_ctx, n_seq, n_ctx_seq);
+  edge_attach_threadpools(edge_ctx, edge_ctx->batch_ctx);
+  if (!edge_ctx->batch_ctx) {
+    stop("Failed to create batch context");
+  }
+  return edge_ctx->batch_ctx;
+}
+
+// Continuous batching over a multi-sequence context. Every slot owns one KV
+// sequence and one sampler chain; requests are assigned to free slots between
+// decode steps, so a new request joins the running batch at the next token
+// boundary. Each step decodes one token for every generating slot plus as
+// many prompt tokens of newly assigned slots as n_batch allows.
+//
+// Used on the R thread by edge_completion_batch_internal() and on the worker
+// thread of the native server, so it must not call into R; failures are
+// reported as std::runtime_error.
+struct EdgeBatchEngine {
+  struct slot {
+    int64_t request = -1;             // caller's id, -1 while the slot is free
+    std::vector<llama_token> tokens;  // prompt, then generated tokens
+    size_t n_prompt = 0;
+    size_t n_prefilled = 0;
+    int n_generated = 0;
+    int n_predict = 0;
+    int i_batch = -1;
+    llama_token last_token = 0;
+    std::string text;
+    std::string finish_reason;        // "stop", "length" or "cancelled" once finished
+    llama_sampler* sampler = NULL;
+  };
+
+  llama_context* ctx;
+  const llama_vocab* vocab;
+  llama_memory_t mem;
+  int n_ctx_seq;
+  int n_batch;
+  std::vector<slot> slots;
+  llama_batch batch;
+
+  EdgeBatchEngine(llama_context* ctx_, const llama_vocab* vocab_)
+    : ctx(ctx_), vocab(vocab_), mem(llama_get_memory(ctx_)),
+      n_ctx_seq((int)llama_n_ctx_seq(ctx_)), n_batch((int)llama_n_batch(ctx_)),
+      slots(llama_n_seq_max(ctx_)), batch(llama_batch_init(llama_n_batch(ctx_), 0, 1)) {
+    llama_memory_clear(mem, true);
+  }
+
+  ~EdgeBatchEngine() {
+    for (auto& sl : slots) {
+      if (sl.sampler) {
+        llama_sampler_free(sl.sampler);
+      }
+    }
+    llama_batch_free(batch);
+  }
+
+  EdgeBatchEngine(const EdgeBatchEngine&) = delete;
+  EdgeBatchEngine& operator=(const EdgeBatchEngine&) = delete;
+
+  int free_slot() const {
+    for (size_t s = 0; s < slots.size(); ++s) {
+      if (slots[s].request < 0) return (int)s;
+    }
+    return -1;
+  }
+
+  int n_active() const {
+    int n = 0;
+    for (const auto& sl : slots) {
+      n += sl.request >= 0;
+    }
+    return n;
+  }
+
+  // Start `request` in slot `s`. The engine takes ownership of `sampler`.
+  // The prompt must be shorter than n_ctx_seq.
+  void assign(int s, int64_t request, std::vector<llama_token> tokens, int n_predict, llama_sampler* sampler) {
+    slot& sl = slots[s];
+    sl.request = request;
+    sl.tokens = std::move(tokens);
+    sl.n_prompt = sl.tokens.size();
+    sl.n_prefilled = 0;
+    sl.n_generated = 0;
+    sl.n_predict = n_predict;
+    sl.text.clear();
+    sl.finish_reason.clear();
+    sl.sampler = sampler;
+    llama_memory_seq_rm(mem, s, -1, -1);
+  }
+
+  // Finish every active slot with `reason`, e.g. after a failed decode
+  template <typename F>
+  void finish_all(const std::string& reason, F on_done) {
+    for (size_t s = 0; s < slots.size(); ++s) {
+      if (slots[s].request >= 0) {
+        slots[s].finish_reason = reason;
+        finish((int)s, on_done);
+      }
+    }
+  }
+
+  // Finish `request` early with what it generated so far. Returns false if
+  // no slot is working on it.
+  template <typename F>
+  bool cancel(int64_t request, F on_done) {
+    for (size_t s = 0; s < slots.size(); ++s) {
+      if (slots[s].request == request) {
+        slots[s].finish_reason = "cancelled";
+        finish((int)s, on_done);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Decode one step and sample the next token of every slot that produced
+  // logits. on_done(slot&) is called for each request that finished; the
+  // slot is free again afterwards. Returns false, sampling nothing, if the
+  // abort callback stopped the decode; the active slots cannot continue
+  // then and the caller must finish_all() them.
+  template <typename F>
+  bool step(F on_done) {
+    batch.n_tokens = 0;
+    for (size_t s = 0; s < slots.size(); ++s) {
+      slot& sl = slots[s];
+      sl.i_batch = -1;
+      if (sl.request >= 0 && sl.n_generated > 0) {
+        sl.i_batch = add_token(sl.last_token, (llama_pos)sl.tokens.size(), (int)s, true);
+        sl.tokens.push_back(sl.last_token);
+        sl.n_prefilled++;
+      }
+    }
+    for (size_t s = 0; s < slots.size() && batch.n_tokens < n_batch; ++s) {
+      slot& sl = slots[s];
+      if (sl.request < 0 || sl.n_generated > 0) continue;
+      while (sl.n_prefilled < sl.n_prompt && batch.n_tokens < n_batch) {
+        const bool is_last = sl.n_prefilled + 1 == sl.n_prompt;
+        const int i = add_token(sl.tokens[sl.n_prefilled], (llama_pos)sl.n_prefilled, (int)s, is_last);
+        sl.n_prefilled++;
+        if (is_last) sl.i_batch = i;
+      }
+    }
+    if (batch.n_tokens == 0) {
+      return true;
+    }
+
+    const int rc = llama_decode(ctx, batch);
+    if (rc == 2) {
+      return false;
+    }
+    if (rc) {
+      throw std::runtime_error("Failed to decode batch");
+    }
+
+    for (size_t s = 0; s < slots.size(); ++s) {
+      slot& sl = slots[s];
+      if (sl.i_batch < 0) continue;
+
+      // llama_sampler_sample() also accepts the token into the chain
+      const llama_token new_token = llama_sampler_sample(sl.sampler, ctx, sl.i_batch);
+      if (llama_vocab_is_eog(vocab, new_token)) {
+        sl.finish_reason = "stop";
+      } else {
+        edge_append_piece(vocab, new_token, sl.text);
+        sl.n_generated++;
+        sl.last_token = new_token;
+        if (sl.n_generated >= sl.n_predict || (int)sl.tokens.size() + 1 >= n_ctx_seq) {
+          sl.finish_reason = "length";
+        }
+      }
+      if (!sl.finish_reason.empty()) {
+        finish((int)s, on_done);
+      }
+    }
+    return true;
+  }
+
+private:
+  int add_token(llama_token token, llama_pos pos, int seq, bool logits) {
+    const int i = batch.n_tokens++;
+    batch.token[i] = token;
+    batch.pos[i] = pos;
+    batch.n_seq_id[i] = 1;
+    batch.seq_id[i][0] = seq;
+    batch.logits[i] = logits;
+    return i;
+  }
+
+  template <typename F>
+  void finish(int s, F on_done) {
+    slot& sl = slots[s];
+    sl.text.resize(edge_utf8_complete_len(sl.text));
+    on_done(sl);
+    llama_sampler_free(sl.sampler);
+    sl.sampler = NULL;
+    sl.request = -1;
+    sl.tokens.clear();
+    llama_memory_seq_rm(mem, s, -1, -1);
+  }
+};
+
+// Return an embeddings context sharing the model that can take `n_seq`
+// sequences totalling `n_tokens` tokens in a single graph run. Like the
+// batch context, it is kept between calls and only recreated when too small.
+static llama_context* edge_get_embedding_context(EdgeModelContext* edge_ctx, int n_seq, int n_tokens) {
+  if (edge_ctx->embd_ctx &&
+      llama_n_seq_max(edge_ctx->embd_ctx) >= (uint32_t)n_seq &&
+      llama_n_ctx(edge_ctx->embd_ctx) >= (uint32_t)n_tokens &&
+      llama_n_ubatch(edge_ctx->embd_ctx) >= (uint32_t)n_tokens) {
+    return edge_ctx->embd_ctx;
+  }
+  if (edge_ctx->embd_ctx) {
+    llama_free(edge_ctx->embd_ctx);
+    edge_ctx->embd_ctx = NULL;
+  }
+
+  // A pack must fit one ubatch: pooling reads each sequence from a single
+  // graph run, and encoder models require it. The KV cache is unified so
+  // that sequences of different lengths are not split into equal-length
+  // ubatches, and cleared before every pack.
+  llama_context_params params = edge_ctx->ctx_params;
+  params.n_ctx = ((uint32_t)n_tokens + 255) / 256 * 256;
+  params.n_batch = n_tokens;
+  params.n_ubatch = n_tokens;
+  params.n_seq_max = n_seq;
+  params.kv_unified = true;
+  params.embeddings = true;
+
+  edge_ctx->embd_ctx = llama_init_from_model(edge_ctx->model, params);
+  if (!edge_ctx->embd_ctx) {
+    stop("Failed to create embedding context");
+  }
+  edge_attach_threadpools(edge_ctx, edge_ctx->embd_ctx);
+  return edge_ctx->embd_ctx;
+}
+
+// Return the scoring context, able to hold `n_seq` sequences in a unified
+// KV cache of `n_tokens` cells. The cache is unified so that every sequence
+// can share the prompt through llama_memory_seq_cp without copying it.
+static llama_context* edge_get_score_context(EdgeModelContext* edge_ctx, int n_seq, int n_tokens) {
+  if (edge_ctx->score_ctx &&
+      llama_n_seq_max(edge_ctx->score_ctx) >= (uint32_t)n_seq &&
+      llama_n_ctx(edge_ctx->score_ctx) >= (uint32_t)n_tokens) {
+    return edge_ctx->score_ctx;
+  }
+  if (edge_ctx->score_ctx) {
+    llama_free(edge_ctx->score_ctx);
+    edge_ctx->score_ctx = NULL;
+  }
+  edge_ctx->score_tokens.clear();
+
+  llama_context_params params = edge_ctx->ctx_params;
+  params.n_ctx = ((uint32_t)n_tokens + 255) / 256 * 256;
+  params.n_seq_max = n_seq;
+  params.kv_unified = true;
+  params.embeddings = false;
+
+  edge_ctx->score_ctx = llama_init_from_model(edge_ctx->model, params);
+  if (!edge_ctx->score_ctx) {
+    stop("Failed to create scoring context");
+  }
+  edge_attach_threadpools(edge_ctx, edge_ctx->score_ctx);
+  return edge_ctx->score_ctx;
+}
+
+// Log-probability of `token` under a row of logits
+static double edge_token_logprob(const float* logits, int n_vocab, llama_token token) {
+  float max_logit = logits[0];
+  for (int i = 1; i < n_vocab; ++i) {
+    max_logit = std::max(max_logit, logits[i]);
+  }
+  double sum = 0.0;
+  for (int i = 0; i < n_vocab; ++i) {
+    sum += std::exp((double)(logits[i] - max_logit));
+  }
+  return (double)(logits[token] - max_logit) - std::log(sum);
+}
+
+// Number of physical CPU cores. Token generation is bound by memory
+// bandwidth, and a second thread on an SMT sibling only competes with the
+// first for it.
+static int edge_physical_cores() {
+#if defined(__linux__)
+  std::set<std::string> cores;
+  for (int cpu = 0; cpu < GGML_MAX_N_THREADS; ++cpu) {
+    std::ifstream siblings("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings");
+    if (!siblings.is_open()) {
+      break;
+    }
+    std::string mask;
+    if (std::getline(siblings, mask)) {
+      cores.insert(mask);
+    }
+  }
+  if (!cores.empty()) {
+    return (int)cores.size();
+  }
+#elif defined(__APPLE__)
+  int n = 0;
+  size_t len = sizeof(n);
+  // Performance cores only on Apple Silicon
+  if (sysctlbyname("hw.perflevel0.physicalcpu", &n, &len, NULL, 0) == 0 && n > 0) {
+    return n;
+  }
+  len = sizeof(n);
+  if (sysctlbyname("hw.physicalcpu", &n, &len, NULL, 0) == 0 && n > 0) {
+    return n;
+  }
+#endif
+  const int n_hw = std::max(1, (int)std::thread::hardware_concurrency());
+  return n_hw <= 4 ? n_hw : n_hw / 2;
+}
+
+// Threadpool settings: `cpus` lists the CPUs the threads may run on (empty
+// for no affinity) and with `strict_cpu` each thread is pinned to one of them
+static ggml_threadpool_params edge_threadpool_params(int n_threads, const std::vector<int>& cpus,
+                                                     int priority, int poll, bool strict_cpu) {
+  ggml_threadpool_params tpp = ggml_threadpool_params_default(n_threads);
+  for (int cpu : cpus) {
+    if (cpu < 0 || cpu >= GGML_MAX_N_THREADS) {
+      stop("CPU ids must be between 0 and " + std::to_string(GGML_MAX_N_THREADS - 1));
+    }
+    tpp.cpumask[cpu] = true;
+  }
+  tpp.prio = (enum ggml_sched_priority)priority;
+  tpp.poll = (uint32_t)poll;
+  tpp.strict_cpu = strict_cpu;
+  return tpp;
+}
+
+// Thread settings of a context, settled before anything is loaded so that
+// bad CPU ids fail early
+struct EdgeThreadConfig {
+  int n_threads = 0;
+  int n_threads_batch = 0;
+  ggml_threadpool_params tpp;
+  ggml_threadpool_params tpp_batch;
+};
+
+static EdgeThreadConfig edge_thread_config(int n_threads, int n_threads_batch, SEXP cpus, SEXP cpus_batch,
+                                           int priority, int poll, bool strict_cpu) {
+  // Token generation uses one thread per physical core (or per listed CPU),
+  // prompt batches are compute bound and use all hardware threads. Both can
+  // be overridden.
+  const std::vector<int> cpu_list = Rf_isNull(cpus) ? std::vector<int>() : as<std::vector<int>>(cpus);
+  const std::vector<int> cpu_list_batch = Rf_isNull(cpus_batch) ? cpu_list : as<std::vector<int>>(cpus_batch);
+  if (n_threads <= 0) {
+    n_threads = cpu_list.empty() ? edge_physical_cores() : (int)cpu_list.size();
+  }
+  if (n_threads_batch <= 0) {
+    n_threads_batch = cpu_list_batch.empty() ? std::max(1, (int)std::thread::hardware_concurrency())
+                                             : (int)cpu_list_batch.size();
+  }
+
+  EdgeThreadConfig cfg;
+  cfg.n_threads = std::min(n_threads, GGML_MAX_N_THREADS);
+  cfg.n_threads_batch = std::min(n_threads_batch, GGML_MAX_N_THREADS);
+  cfg.tpp = edge_threadpool_params(cfg.n_threads, cpu_list, priority, poll, strict_cpu);
+  cfg.tpp_batch = edge_threadpool_params(cfg.n_threads_batch, cpu_list_batch, priority, poll, strict_cpu);
+  return cfg;
+}
+
+// Registry key of a model file. The size is left negative when the file
+// cannot be inspected, which keeps the model out of the registry.
+static EdgeModelKey edge_model_key(const std::string& model_path, int n_gpu_layers) {
+  EdgeModelKey key;
+  key.path = model_path;
+  key.n_gpu_layers = n_gpu_layers;
+#ifdef _WIN32
+  char resolved[_MAX_PATH];
+  if (_fullpath(resolved, model_path.c_str(), sizeof(resolved))) {
+    key.path = resolved;
+  }
+  struct _stat64 st;
+  const bool found = _stat64(model_path.c_str(), &st) == 0;
+#else
+  char* resolved = realpath(model_path.c_str(), NULL);
+  if (resolved) {
+    key.path = resolved;
+    free(resolved);
+  }
+  struct stat st;
+  const bool found = stat(model_path.c_str(), &st) == 0;
+#endif
+  if (found) {
+    key.size = (double)st.st_size;
+    key.mtime = (double)st.st_mtime;
+  }
+  return key;
+}
+
+// Process-wide registry of loaded weights, so that loading a file that is
+// already loaded returns the same llama_model (and the same mapping of the
+// file) instead of a second copy. An entry tracks the model while anything
+// references it; once released, the model is kept warm for
+// g_model_keep_warm seconds so that loading it again is immediate. Warm
+// models past their time are freed on the next registry access.
+struct EdgeModelEntry {
+  std::weak_ptr<EdgeModel> live;
+  std::unique_ptr<EdgeModel> warm;
+  std::chrono::steady_clock::time_point released;
+};
+
+static std::mutex g_model_registry_mutex;
+// Never destroyed: warm models must not be freed by static destructors at exit
+static std::map<EdgeModelKey, EdgeModelEntry>& g_model_registry = *new std::map<EdgeModelKey, EdgeModelEntry>();
+static double g_model_keep_warm = 0;
+
+// Move warm models whose time is up to `expired`, to be freed once the
+// registry lock is released, and drop entries of models that are gone.
+// Requires g_model_registry_mutex.
+static void edge_model_registry_sweep(std::vector<std::unique_ptr<EdgeModel>>& expired) {
+  const auto now = std::chrono::steady_clock::now();
+  for (auto it = g_model_registry.begin(); it != g_model_registry.end(); ) {
+    EdgeModelEntry& entry = it->second;
+    if (entry.warm && std::chrono::duration<double>(now - entry.released).count() >= g_model_keep_warm) {
+      expired.push_back(std::move(entry.warm));
+    }
+    if (!entry.warm && entry.live.expired()) {
+      it = g_model_registry.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Deleter of registered models: runs when the last reference is dropped
+static void edge_model_release(EdgeModel* model) {
+  std::unique_ptr<EdgeModel> owned(model);
+  std::vector<std::unique_ptr<EdgeModel>> expired;
+  std::lock_guard<std::mutex> lock(g_model_registry_mutex);
+  auto it = g_model_registry.find(model->key);
+  if (g_model_keep_warm > 0 && it != g_model_registry.end() && !it->second.warm) {
+    it->second.warm = std::move(owned);
+    it->second.released = std::chrono::steady_clock::now();
+  }
+  edge_model_registry_sweep(expired);
+}
+
+// Load model weights, or share them when the registry has them already, with
+// diagnostics when llama.cpp cannot load them
+static EdgeModelRef edge_model_load(const std::string& model_path, int n_gpu_layers) {
+  const EdgeModelKey key = edge_model_key(model_path, n_gpu_layers);
+  if (key.size >= 0) {
+    // Declared first so that expired models are freed after the unlock
+    std::vector<std::unique_ptr<EdgeModel>> expired;
+    std::lock_guard<std::mutex> lock(g_model_registry_mutex);
+    auto it = g_model_registry.find(key);
+    if (it != g_model_registry.end()) {
+      if (EdgeModelRef live = it->second.live.lock()) {
+        return live;
+      }
+      if (it->second.warm) {
+        EdgeModelRef ref(it->second.warm.release(), edge_model_release);
+        it->second.live = ref;
+        return ref;
+      }
+    }
+    edge_model_registry_sweep(expired);
+  }
+
+  llama_model_params model_params = llama_model_default_params();
+  model_params.n_gpu_layers = n_gpu_layers;
+
+  struct llama_model* model = llama_model_load_from_file(model_path.c_str(), model_params);
+  if (!model) {
+    // Check if file exists
+    std::ifstream file(model_path);
+    if (!file.good()) {
+      stop("Model file does not exist or is not readable: " + model_path);
+    }
+
+    // Enhanced diagnostics for GGUF files
+    std::string diagnostic_msg = "Failed to load GGUF model from: " + model_path +
+                                 ". The file exists but llama.cpp cannot parse it.\n";
+
+    // Check if it looks like a GGUF file
+    file.seekg(0);
+    char magic[4];
+    if (file.read(magic, 4) && std::string(magic, 4) == "GGUF") {
+      diagnostic_msg += "File has valid GGUF magic header. Possible issues:\n";
+      diagnostic_msg += "- Incompatible GGUF version (try a different llama.cpp version)\n";
+      diagnostic_msg += "- Model architecture not supported\n";
+      diagnostic_msg += "- File corruption during download\n";
+      diagnostic_msg += "- Insufficient memory (try smaller n_ctx or n_gpu_layers=0)\n";
+    } else {
+      diagnostic_msg += "File does not have GGUF magic header. This is not a valid GGUF file.\n";
+      diagnostic_msg += "For Ollama models, ensure you're using the correct blob file path.\n";
+    }
+
+    stop(diagnostic_msg);
+  }
+
+  std::unique_ptr<EdgeModel> loaded(new EdgeModel());
+  loaded->model = model;
+  loaded->path = model_path;
+  loaded->key = key;
+  if (key.size < 0) {
+    return EdgeModelRef(loaded.release());
+  }
+
+  EdgeModelRef ref(loaded.release(), edge_model_release);
+  std::lock_guard<std::mutex> lock(g_model_registry_mutex);
+  g_model_registry[key].live = ref;
+  return ref;
+}
+
+// KV cache element type from its name. Quantized types shrink the cache and
+// the memory read per generated token; a quantized V cache needs flash
+// attention.
+static ggml_type edge_cache_type(const std::string& name, bool is_v, bool flash_attn) {
+  static const std::pair<const char*, ggml_type> types[] = {
+    {"f16", GGML_TYPE_F16}, {"f32", GGML_TYPE_F32}, {"bf16", GGML_TYPE_BF16},
+    {"q8_0", GGML_TYPE_Q8_0}, {"q5_1", GGML_TYPE_Q5_1}, {"q5_0", GGML_TYPE_Q5_0},
+    {"q4_1", GGML_TYPE_Q4_1}, {"q4_0", GGML_TYPE_Q4_0}, {"iq4_nl", GGML_TYPE_IQ4_NL}
+  };
+  for (const auto& t : types) {
+    if (name == t.first) {
+      if (is_v && ggml_is_quantized(t.second) && !flash_attn) {
+        stop("cache_type_v = '" + name + "' requires flash_attn = TRUE");
+      }
+      return t.second;
+    }
+  }
+  stop("Unsupported KV cache type: " + name);
+}
+
+// Create a context on loaded weights and wrap it in an edge_model_context
+static SEXP edge_context_new(const EdgeModelRef& model_ref, int n_ctx, bool flash_attn, bool embeddings,
+                             ggml_type type_k, ggml_type type_v, EdgeThreadConfig threads, bool profile) {
+  llama_context_params ctx_params = llama_context_default_params();
+  ctx_params.n_ctx = n_ctx;
+
+  // Adaptive batch size optimization for small models
+  // Small models benefit from larger batches relative to context size
+  int optimal_batch;
+  if (n_ctx <= 512) {
+    optimal_batch = std::min(512, n_ctx);  // Very small context: use up to full context
+  } else if (n_ctx <= 2048) {
+    optimal_batch = std::min(512, n_ctx / 2);  // Small models: use 1/2 context
+  } else if (n_ctx <= 4096) {
+    optimal_batch = std::min(1024, n_ctx / 4);  // Medium models: use 1/4 context
+  } else {
+    optimal_batch = std::min(2048, n_ctx / 4);  // Large context: cap at 2048
+  }
+  ctx_params.n_batch = optimal_batch;
+
+  ctx_params.n_threads = threads.n_threads;
+  ctx_params.n_threads_batch = threads.n_threads_batch;
+  // flash_attn was a bool in older llama.cpp; b8179 changed to an enum
+  ctx_params.flash_attn_type = flash_attn
+    ? LLAMA_FLASH_ATTN_TYPE_ENABLED
+    : LLAMA_FLASH_ATTN_TYPE_DISABLED;
+  ctx_params.embeddings = embeddings;
+  ctx_params.type_k = type_k;
+  ctx_params.type_v = type_v;
+  // Time prompt and generation steps for llama_perf_context() (edge_benchmark)
+  ctx_params.no_perf = false;
+  // The eval callback can only be set here. Even while it asks for no nodes,
+  // the scheduler then synchronizes after every split, so only on request.
+  std::unique_ptr<EdgeProfiler> profiler;
+  if (profile) {
+    profiler.reset(new EdgeProfiler());
+    ctx_params.cb_eval = edge_profile_eval;
+    ctx_params.cb_eval_user_data = profiler.get();
+  }
+
+  struct llama_context* ctx = llama_init_from_model(model_ref->model, ctx_params);
+  if (!ctx) {
+    if (ggml_is_quantized(type_k) || ggml_is_quantized(type_v)) {
+      stop(std::string("Failed to create context for model with a ") + ggml_type_name(type_k) + "/" +
+           ggml_type_name(type_v) + " KV cache; the attention head size may not be a multiple of "
+           "the type's block size");
+    }
+    stop("Failed to create context for model");
+  }
+
+  auto edge_ctx = std::make_unique<EdgeModelContext>();
+  edge_ctx->model_ref = model_ref;
+  edge_ctx->model = model_ref->model;
+  edge_ctx->ctx = ctx;
+  edge_ctx->profiler = std::move(profiler);
+  // Auxiliary and server contexts are created from these and not profiled
+  ctx_params.cb_eval = NULL;
+  ctx_params.cb_eval_user_data = NULL;
+  edge_ctx->ctx_params = ctx_params;
+
+  // Keep the worker threads alive between graphs instead of starting new
+  // ones for every decode. With a separate batch pool the generation pool
+  // starts paused; llama.cpp pauses whichever pool it is not using.
+  const bool separate_batch = !ggml_threadpool_params_match(&threads.tpp, &threads.tpp_batch);
+  if (separate_batch) {
+    edge_ctx->threadpool_batch = ggml_threadpool_new(&threads.tpp_batch);
+    threads.tpp.paused = true;
+  }
+  edge_ctx->threadpool = ggml_threadpool_new(&threads.tpp);
+  if (!edge_ctx->threadpool || (separate_batch && !edge_ctx->threadpool_batch)) {
+    stop("Failed to create CPU threadpool");
+  }
+  edge_ctx->threadpool_size = threads.n_threads;
+  edge_ctx->threadpool_batch_size = threads.n_threads_batch;
+  edge_attach_threadpools(edge_ctx.get(), ctx);
+
+  XPtr<EdgeModelContext> ptr(edge_ctx.release(), true);
+  ptr.attr("class") = "edge_model_context";
+
+  return ptr;
+}
+
+// [[Rcpp::export]]
+SEXP edge_load_model_internal(std::string model_path, int n_ctx = 2048, int n_gpu_layers = 0, int n_threads = 0, bool flash_attn = true, bool embeddings = false, int n_threads_batch = 0, SEXP cpus = R_NilValue, SEXP cpus_batch = R_NilValue, int priority = 0, int poll = 50, bool strict_cpu = false, int numa = 0, std::string cache_type_k = "f16", std::string cache_type_v = "f16", bool profile = false) {
+  try {
+    // Ensure llama is properly initialized
+    ensure_llama_initialized();
+
+    EdgeThreadConfig threads = edge_thread_config(n_threads, n_threads_batch, cpus, cpus_batch,
+                                                  priority, poll, strict_cpu);
+    const ggml_type type_k = edge_cache_type(cache_type_k, false, flash_attn);
+    const ggml_type type_v = edge_cache_type(cache_type_v, true, flash_attn);
+
+    // Must precede the load: it decides how the weights are mapped
+    edge_numa_apply(numa);
+
+    return edge_context_new(edge_model_load(model_path, n_gpu_layers), n_ctx, flash_attn, embeddings,
+                            type_k, type_v, threads, profile);
+  } catch (const std::exception& e) {
+    stop("Error loading model: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+SEXP edge_load_weights_internal(std::string model_path, int n_gpu_layers = 0, int numa = 0) {
+  try {
+    ensure_llama_initialized();
+    edge_numa_apply(numa);
+
+    XPtr<EdgeModelRef> ptr(new EdgeModelRef(edge_model_load(model_path, n_gpu_layers)), true);
+    ptr.attr("class") = "edge_model";
+    return ptr;
+  } catch (const std::exception& e) {
+    stop("Error loading model: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+SEXP edge_new_context_internal(SEXP weights_ptr, int n_ctx = 2048, int n_threads = 0, bool flash_attn = true, bool embeddings = false, int n_threads_batch = 0, SEXP cpus = R_NilValue, SEXP cpus_batch = R_NilValue, int priority = 0, int poll = 50, bool strict_cpu = false, std::string cache_type_k = "f16", std::string cache_type_v = "f16", bool profile = false) {
+  try {
+    if (TYPEOF(weights_ptr) != EXTPTRSXP) {
+      stop("Invalid model");
+    }
+    XPtr<EdgeModelRef> ref(weights_ptr);
+    if (ref.get() == nullptr || !*ref) {
+      stop("The model has been freed");
+    }
+
+    EdgeThreadConfig threads = edge_thread_config(n_threads, n_threads_batch, cpus, cpus_batch,
+                                                  priority, poll, strict_cpu);
+    return edge_context_new(*ref, n_ctx, flash_attn, embeddings,
+                            edge_cache_type(cache_type_k, false, flash_attn),
+                            edge_cache_type(cache_type_v, true, flash_attn), threads, profile);
+  } catch (const std::exception& e) {
+    stop("Error creating context: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+List edge_weights_info_internal(SEXP weights_ptr) {
+  if (TYPEOF(weights_ptr) != EXTPTRSXP) {
+    stop("Invalid model");
+  }
+  XPtr<EdgeModelRef> ref(weights_ptr);
+  if (ref.get() == nullptr || !*ref) {
+    return List::create(Named("valid") = false);
+  }
+
+  const EdgeModelRef& m = *ref;
+  char desc[256];
+  llama_model_desc(m->model, desc, sizeof(desc));
+  return List::create(
+    Named("valid") = true,
+    Named("path") = m->path,
+    Named("description") = std::string(desc),
+    Named("size_bytes") = (double)llama_model_size(m->model),
+    Named("n_params") = (double)llama_model_n_params(m->model),
+    // The handle itself is one of the references
+    Named("n_contexts") = (int)m.use_count() - 1
+  );
+}
+
+// [[Rcpp::export]]
+void edge_free_weights_internal(SEXP weights_ptr) {
+  if (TYPEOF(weights_ptr) != EXTPTRSXP) {
+    return;
+  }
+  XPtr<EdgeModelRef> ref(weights_ptr);
+  if (ref.get() != nullptr) {
+    ref->reset();
+  }
+}
+
+// [[Rcpp::export]]
+double edge_keep_warm_internal(double seconds = -1) {
+  std::vector<std::unique_ptr<EdgeModel>> expired;
+  std::lock_guard<std::mutex> lock(g_model_registry_mutex);
+  const double previous = g_model_keep_warm;
+  if (seconds >= 0) {
+    g_model_keep_warm = seconds;
+    edge_model_registry_sweep(expired);
+  }
+  return previous;
+}
+
+// [[Rcpp::export]]
+bool edge_model_resident_internal(std::string model_path, int n_gpu_layers = 0) {
+  const EdgeModelKey key = edge_model_key(model_path, n_gpu_layers);
+  std::lock_guard<std::mutex> lock(g_model_registry_mutex);
+  auto it = g_model_registry.find(key);
+  return it != g_model_registry.end() && (it->second.warm || !it->second.live.expired());
+}
+
+// [[Rcpp::export]]
+DataFrame edge_resident_models_internal() {
+  // References taken under the lock are dropped after it, in case one of
+  // them turns out to be the last
+  std::vector<EdgeModelRef> held;
+  std::vector<std::unique_ptr<EdgeModel>> expired;
+  std::vector<const EdgeModel*> models;
+  std::vector<int> n_refs;
+  std::vector<double> expires_in;
+
+  std::unique_lock<std::mutex> lock(g_model_registry_mutex);
+  edge_model_registry_sweep(expired);
+  const auto now = std::chrono::steady_clock::now();
+  for (auto& kv : g_model_registry) {
+    EdgeModelEntry& entry = kv.second;
+    if (EdgeModelRef live = entry.live.lock()) {
+      // Not counting the one just taken
+      n_refs.push_back((int)live.use_count() - 1);
+      expires_in.push_back(NA_REAL);
+      models.push_back(live.get());
+      held.push_back(live);
+    } else if (entry.warm) {
+      n_refs.push_back(0);
+      expires_in.push_back(std::max(0.0, g_model_keep_warm - std::chrono::duration<double>(now - entry.released).count()));
+      models.push_back(entry.warm.get());
+    }
+  }
+
+  const int n = (int)models.size();
+  CharacterVector path(n), description(n);
+  NumericVector size_bytes(n), file_size(n), expires(n);
+  IntegerVector n_gpu_layers(n), refs(n);
+  LogicalVector warm(n);
+  for (int i = 0; i < n; ++i) {
+    const EdgeModel* m = models[i];
+    char desc[256];
+    llama_model_desc(m->model, desc, sizeof(desc));
+    path[i] = m->key.path;
+    description[i] = std::string(desc);
+    size_bytes[i] = (double)llama_model_size(m->model);
+    file_size[i] = m->key.size;
+    n_gpu_layers[i] = m->key.n_gpu_layers;
+    refs[i] = n_refs[i];
+    warm[i] = !R_IsNA(expires_in[i]);
+    expires[i] = expires_in[i];
+  }
+  lock.unlock();
+
+  return DataFrame::create(
+    Named("path") = path,
+    Named("description") = description,
+    Named("size_bytes") = size_bytes,
+    Named("file_size") = file_size,
+    Named("n_gpu_layers") = n_gpu_layers,
+    Named("n_refs") = refs,
+    Named("warm") = warm,
+    Named("expires_in") = expires,
+    Named("stringsAsFactors") = false
+  );
+}
+
+// [[Rcpp::export]]
+IntegerVector edge_set_threads_internal(SEXP model_ptr, int n_threads = 0, int n_threads_batch = 0) {
+  if (TYPEOF(model_ptr) != EXTPTRSXP) {
+    stop("Invalid model context");
+  }
+  XPtr<EdgeModelContext> edge_ctx(model_ptr);
+  if (!edge_ctx->is_valid()) {
+    stop("Invalid model context");
+  }
+
+  // The pools keep the threads they were created with; fewer of them can be
+  // used without rebuilding a pool a context may still refer to
+  llama_context_params& params = edge_ctx->ctx_params;
+  if (edge_ctx->threadpool) {
+    const int max_threads = edge_ctx->threadpool_size;
+    const int max_threads_batch = edge_ctx->threadpool_batch_size;
+    if (n_threads > max_threads) {
+      stop("n_threads can be at most " + std::to_string(max_threads) +
+           ", the number the model was loaded with");
+    }
+    if (n_threads_batch > max_threads_batch) {
+      stop("n_threads_batch can be at most " + std::to_string(max_threads_batch) +
+           ", the number the model was loaded with");
+    }
+  }
+  if (n_threads > 0) params.n_threads = n_threads;
+  if (n_threads_batch > 0) params.n_threads_batch = n_threads_batch;
+
+  llama_context* contexts[] = {edge_ctx->ctx, edge_ctx->batch_ctx, edge_ctx->embd_ctx, edge_ctx->score_ctx};
+  for (llama_context* c : contexts) {
+    if (c) {
+      llama_set_n_threads(c, params.n_threads, params.n_threads_batch);
+    }
+  }
+
+  return IntegerVector::create(
+    Named("n_threads") = (int)params.n_threads,
+    Named("n_threads_batch") = (int)params.n_threads_batch
+  );
+}
+
+// [[Rcpp::export]]
+SEXP edge_sampler_internal(SEXP model_ptr, double temperature = 0.8, double top_p = 0.95, int top_k = 40, double min_p = 0.05, double typical_p = 1.0, double repeat_penalty = 1.0, int penalty_last_n = 64, double frequency_penalty = 0.0, double presence_penalty = 0.0, double dry_multiplier = 0.0, double dry_base = 1.75, int dry_allowed_length = 2, int dry_penalty_last_n = -1, double seed = -1) {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) {
+      stop("Invalid model context");
+    }
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    if (!edge_ctx->is_valid()) {
+      stop("Invalid model context");
+    }
+
+    if (temperature < 0.0 || temperature > 2.0) stop("Temperature must be between 0.0 and 2.0");
+    if (top_p <= 0.0 || top_p > 1.0) stop("top_p must be between 0.0 and 1.0");
+    if (min_p < 0.0 || min_p > 1.0) stop("min_p must be between 0.0 and 1.0");
+    if (typical_p <= 0.0 || typical_p > 1.0) stop("typical_p must be between 0.0 and 1.0");
+    if (repeat_penalty <= 0.0) stop("repeat_penalty must be positive");
+    if (dry_multiplier < 0.0) stop("dry_multiplier must not be negative");
+    if (seed > 4294967294.0) stop("seed must be below 2^32 - 1");
+
+    const llama_vocab* vocab = llama_model_get_vocab(edge_ctx->model);
+    const int n_ctx = (int)llama_n_ctx(edge_ctx->ctx);
+
+    // Same order as llama.cpp's default chain: penalties and DRY see the full
+    // distribution, truncation comes next and temperature last
+    auto * chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    if (repeat_penalty != 1.0 || frequency_penalty != 0.0 || presence_penalty != 0.0) {
+      llama_sampler_chain_add(chain, llama_sampler_init_penalties(
+        penalty_last_n < 0 ? n_ctx : penalty_last_n,
+        (float)repeat_penalty, (float)frequency_penalty, (float)presence_penalty));
+    }
+    if (dry_multiplier > 0.0) {
+      static const char* seq_breakers[] = {"\n", ":", "\"", "*"};
+      llama_sampler_chain_add(chain, llama_sampler_init_dry(
+        vocab, n_ctx, (float)dry_multiplier, (float)dry_base, dry_allowed_length,
+        dry_penalty_last_n, seq_breakers, sizeof(seq_breakers) / sizeof(seq_breakers[0])));
+    }
+    if (top_k > 0) {
+      llama_sampler_chain_add(chain, llama_sampler_init_top_k(top_k));
+    }
+    if (typical_p < 1.0) {
+      llama_sampler_chain_add(chain, llama_sampler_init_typical((float)typical_p, 1));
+    }
+    if (top_p < 1.0) {
+      llama_sampler_chain_add(chain, llama_sampler_init_top_p((float)top_p, 1));
+    }
+    if (min_p > 0.0) {
+      llama_sampler_chain_add(chain, llama_sampler_init_min_p((float)min_p, 1));
+    }
+    if (temperature > 0.0) {
+      llama_sampler_chain_add(chain, llama_sampler_init_temp((float)temperature));
+      llama_sampler_chain_add(chain, llama_sampler_init_dist(seed < 0 ? LLAMA_DEFAULT_SEED : (uint32_t)seed));
+    } else {
+      llama_sampler_chain_add(chain, llama_sampler_init_greedy());
+    }
+
+    auto config = std::make_unique<EdgeSamplerConfig>();
+    config->chain = chain;
+    config->model = edge_ctx->model_ref;
+
+    // Keeps the context from being collected while the handle is in use; an
+    // explicit edge_free_model() invalidates the handle instead
+    XPtr<EdgeSamplerConfig> ptr(config.release(), true, R_NilValue, model_ptr);
+    ptr.attr("class") = "edge_sampler";
+    return ptr;
+  } catch (const std::exception& e) {
+    stop("Error creating sampler: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+SEXP edge_grammar_internal(SEXP model_ptr, std::string grammar_str, std::string grammar_root = "root") {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) {
+      stop("Invalid model context");
+    }
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    if (!edge_ctx->is_valid()) {
+      stop("Invalid model context");
+    }
+    if (grammar_str.empty()) {
+      stop("grammar must not be empty");
+    }
+
+    EdgeGrammarRef compiled = edge_compile_grammar(edge_ctx->model_ref, grammar_str, grammar_root);
+    if (!compiled) {
+      stop("Failed to parse GBNF grammar. Check grammar syntax.");
+    }
+
+    // Keeps the context from being collected while the handle is in use; an
+    // explicit edge_free_model() invalidates the handle instead
+    XPtr<EdgeGrammarRef> ptr(new EdgeGrammarRef(std::move(compiled)), true, R_NilValue, model_ptr);
+    ptr.attr("class") = "edge_grammar";
+    return ptr;
+  } catch (const std::exception& e) {
+    stop("Error compiling grammar: " + std::string(e.what()));
+  }
+}
+
+// Tokens a grammar allows after accepting `accepted`, for the tests. The
+// vocabulary is passed to the sampler in slices of `slice` candidates (the
+// whole of it when slice <= 0): from a quarter of the vocabulary up the
+// masks come from the trie walk, below it from the per-candidate check.
+// [[Rcpp::export]]
+LogicalVector edge_grammar_mask_internal(SEXP grammar_ptr, IntegerVector accepted, int slice = 0) {
+  try {
+    if (TYPEOF(grammar_ptr) != EXTPTRSXP) {
+      stop("Invalid grammar");
+    }
+    const EdgeGrammarRef handle = edge_grammar_handle(grammar_ptr);
+
+    const int n_vocab = llama_vocab_n_tokens(handle->vocab);
+    std::unique_ptr<llama_sampler, decltype(&llama_sampler_free)> grammar(
+        llama_sampler_clone(handle->tmpl), llama_sampler_free);
+    for (int token : accepted) {
+      llama_sampler_accept(grammar.get(), token);
+    }
+
+    if (slice <= 0) {
+      slice = n_vocab;
+    }
+    LogicalVector allowed(n_vocab);
+    std::vector<llama_token_data> data(slice);
+    for (int begin = 0; begin < n_vocab; begin += slice) {
+      const int n = std::min(slice, n_vocab - begin);
+      for (int i = 0; i < n; ++i) {
+        data[i] = { begin + i, 0.0f, 0.0f };
+      }
+      llama_token_data_array cur_p = { data.data(), (size_t)n, -1, false };
+      llama_sampler_apply(grammar.get(), &cur_p);
+      for (int i = 0; i < n; ++i) {
+        allowed[begin + i] = data[i].logit != -INFINITY;
+      }
+    }
+    return allowed;
+  } catch (const std::exception& e) {
+    stop("Error checking grammar masks: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+std::string edge_completion_internal(SEXP model_ptr, std::string prompt, int n_predict = 128, double temperature = 0.8, double top_p = 0.95, SEXP sampler_ptr = R_NilValue, double timeout_seconds = 0) {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) {
+      stop("Invalid model context");
+    }
+
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+
+    if (!edge_ctx->is_valid() || edge_ctx->ctx == nullptr || edge_ctx->model == nullptr) {
+      stop("Invalid model context or null pointers");
+    }
+
+    // Validate input parameters
+    if (n_predict <= 0) {
+      stop("n_predict must be positive");
+    }
+    if (temperature < 0.0 || temperature > 2.0) {
+      stop("Temperature must be between 0.0 and 2.0");
+    }
+    if (top_p <= 0.0 || top_p > 1.0) {
+      stop("top_p must be between 0.0 and 1.0");
+    }
+
+    // Get vocabulary from model
+    const struct llama_vocab* vocab = llama_model_get_vocab(edge_ctx->model);
+    if (!vocab) {
+      stop("Failed to get vocabulary from model");
+    }
+    
+    // Tokenize and process the prompt, reusing any prefix already in the KV cache
+    EdgeCallScope scope(edge_ctx.get(), timeout_seconds);
+    const std::vector<llama_token> prompt_tokens = edge_tokenize_prompt(vocab, prompt, llama_n_ctx(edge_ctx->ctx));
+    edge_decode_prompt(edge_ctx.get(), prompt_tokens);
+
+    // Sampler chain from edge_sampler(), or one built from temperature/top_p
+    bool owns_sampler = false;
+    auto * sampler = edge_acquire_sampler(sampler_ptr, edge_ctx->model_ref, NULL, temperature, top_p, owns_sampler);
+    std::unique_ptr<llama_sampler, decltype(&llama_sampler_free)> owned_sampler(
+      owns_sampler ? sampler : NULL, llama_sampler_free);
+
+    std::string result;  // Only collect generated text, not prompt
+    result.reserve(n_predict * 8);
+    edge_generate(edge_ctx.get(), vocab, sampler, n_predict, result,
+                  [](const char*, size_t, int) { return true; });
+
+    scope.rethrow_interrupt();
+    return result;
+
+  } catch (const std::exception& e) {
+    stop("Error during completion: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+void edge_free_model_internal(SEXP model_ptr) {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) {
+      warning("Invalid model pointer type");
+      return;
+    }
+
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    if (edge_ctx.get() != nullptr) {
+      edge_ctx->cleanup();
+    }
+
+  } catch (const std::exception& e) {
+    warning("Error freeing model: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+bool is_valid_model_internal(SEXP model_ptr) {
+  try {
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    return edge_ctx->is_valid();
+  } catch (...) {
+    return false;
+  }
+}
+
+// Native destination for streamed text: a file opened for appending or a
+// file descriptor. Written without going through R.
+struct EdgeStreamSink {
+  std::ofstream file;
+  int fd = -1;
+
+  EdgeStreamSink(const std::string& path, int fd_) : fd(fd_) {
+    if (!path.empty()) {
+      file.open(path, std::ios::binary | std::ios::app);
+      if (!file) {
+        stop("Cannot open output file: " + path);
+      }
+    }
+  }
+
+  bool active() const {
+    return file.is_open() || fd >= 0;
+  }
+
+  void write(const std::string& text) {
+    if (file.is_open()) {
+      file.write(text.data(), (std::streamsize)text.size());
+      file.flush();
+    }
+    if (fd >= 0) {
+      size_t done = 0;
+      while (done < text.size()) {
+#ifdef _WIN32
+        const int n = ::_write(fd, text.data() + done, (unsigned int)(text.size() - done));
+#else
+        const ssize_t n = ::write(fd, text.data() + done, text.size() - done);
+#endif
+        if (n <= 0) break;
+        done += (size_t)n;
+      }
+    }
+  }
+};
+
+// [[Rcpp::export]]
+List edge_completion_stream_internal(SEXP model_ptr, std::string prompt, SEXP callback, int n_predict = 128, double temperature = 0.8, double top_p = 0.95, SEXP sampler_ptr = R_NilValue, int chunk_tokens = 1, double chunk_ms = 0, std::string output_path = "", int output_fd = -1, double timeout_seconds = 0) {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) {
+      stop("Invalid model context");
+    }
+    
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+
+    if (!edge_ctx->is_valid() || edge_ctx->ctx == nullptr || edge_ctx->model == nullptr) {
+      stop("Invalid model context or null pointers");
+    }
+
+    // Validate input parameters
+    if (n_predict <= 0) {
+      stop("n_predict must be positive");
+    }
+    if (temperature < 0.0 || temperature > 2.0) {
+      stop("Temperature must be between 0.0 and 2.0");
+    }
+    if (top_p <= 0.0 || top_p > 1.0) {
+      stop("top_p must be between 0.0 and 1.0");
+    }
+    if (chunk_tokens <= 0) {
+      stop("chunk_tokens must be positive");
+    }
+    if (chunk_ms < 0.0) {
+      stop("chunk_ms must not be negative");
+    }
+
+    // Get vocabulary from model
+    const struct llama_vocab* vocab = llama_model_get_vocab(edge_ctx->model);
+    if (!vocab) {
+      stop("Failed to get vocabulary from model");
+    }
+
+    const bool has_callback = !Rf_isNull(callback);
+    EdgeStreamSink sink(output_path, output_fd);
+
+    // Tokenize and process the prompt, reusing any prefix already in the KV cache
+    EdgeCallScope scope(edge_ctx.get(), timeout_seconds);
+    const std::vector<llama_token> prompt_tokens = edge_tokenize_prompt(vocab, prompt, llama_n_ctx(edge_ctx->ctx));
+    const int n_reused = edge_decode_prompt(edge_ctx.get(), prompt_tokens);
+
+    // Sampler chain from edge_sampler(), or one built from temperature/top_p
+    bool owns_sampler = false;
+    auto * sampler = edge_acquire_sampler(sampler_ptr, edge_ctx->model_ref, NULL, temperature, top_p, owns_sampler);
+    std::unique_ptr<llama_sampler, decltype(&llama_sampler_free)> owned_sampler(
+      owns_sampler ? sampler : NULL, llama_sampler_free);
+
+    std::string full_response;  // Track generated text only
+    full_response.reserve(n_predict * 8);
+    std::vector<std::string> tokens_generated;
+
+    // Text is buffered natively and handed on in chunks of chunk_tokens
+    // tokens, or after chunk_ms milliseconds, whichever comes first. A chunk
+    // only ever ends on a whole UTF-8 character.
+    typedef std::chrono::steady_clock clock;
+    std::string pending;
+    int pending_tokens = 0;
+    clock::time_point chunk_start = clock::now();
+
+    auto flush = [&](int n_tokens) {
+      if (pending.empty()) {
+        return true;
+      }
+      tokens_generated.push_back(pending);
+      if (sink.active()) {
+        sink.write(pending);
+      }
+      pending.clear();
+      pending_tokens = 0;
+      chunk_start = clock::now();
+      if (!has_callback) {
+        return true;
+      }
+
+      try {
+        List callback_data = List::create(
+          Named("token") = tokens_generated.back(),
+          Named("position") = n_tokens,
+          Named("is_final") = false,
+          Named("total_tokens") = n_tokens
+        );
+
+        SEXP result = Function(callback)(callback_data);
+
+        // Check if callback wants to stop early
+        if (is<LogicalVector>(result)) {
+          LogicalVector stop_signal = as<LogicalVector>(result);
+          if (stop_signal.length() > 0 && stop_signal[0] == false) {
+            return false;
+          }
+        }
+      } catch (const std::exception& e) {
+        warning("Callback error: " + std::string(e.what()));
+      }
+      return true;
+    };
+
+    int n_last = 0;
+    const EdgeGenerateResult gen = edge_generate(edge_ctx.get(), vocab, sampler, n_predict, full_response,
+      [&](const char* text, size_t len, int n_tokens) {
+        pending.append(text, len);
+        pending_tokens += n_tokens - n_last;
+        n_last = n_tokens;
+        if (pending_tokens >= chunk_tokens ||
+            (chunk_ms > 0 && std::chrono::duration<double, std::milli>(clock::now() - chunk_start).count() >= chunk_ms)) {
+          return flush(n_tokens);
+        }
+        return true;
+      });
+
+    bool stopped_early = gen.finish_reason != "length";
+    if (!flush(gen.n_tokens)) {
+      stopped_early = true;
+    }
+
+    // Send final callback
+    if (has_callback) {
+      try {
+        List final_callback_data = List::create(
+          Named("token") = "",
+          Named("position") = gen.n_tokens,
+          Named("is_final") = true,
+          Named("total_tokens") = gen.n_tokens,
+          Named("full_response") = full_response,
+          Named("stopped_early") = stopped_early,
+          Named("finish_reason") = gen.finish_reason
+        );
+        Function(callback)(final_callback_data);
+      } catch (const std::exception& e) {
+        warning("Final callback error: " + std::string(e.what()));
+      }
+    }
+
+    scope.rethrow_interrupt();
 
     // Return summary information
     return List::create(
       Named("full_response") = full_response,
       Named("tokens_generated") = tokens_generated,
-      Named("total_tokens") = tokens_count,
+      Named("total_tokens") = gen.n_tokens,
       Named("stopped_early") = stopped_early,
-      Named("original_prompt") = prompt
+      Named("finish_reason") = gen.finish_reason,
+      Named("original_prompt") = prompt,
+      Named("reused_tokens") = n_reused
     );
-    
+
   } catch (const std::exception& e) {
     stop("Error during streaming completion: " + std::string(e.what()));
   }
 }
 
 // [[Rcpp::export]]
-std::string edge_completion_grammar_internal(SEXP model_ptr, std::string prompt, std::string grammar_str, std::string grammar_root, int n_predict = 512, double temperature = 0.3, double top_p = 0.95) {
+std::string edge_completion_grammar_internal(SEXP model_ptr, std::string prompt, SEXP grammar, std::string grammar_root, int n_predict = 512, double temperature = 0.3, double top_p = 0.95, SEXP sampler_ptr = R_NilValue, double timeout_seconds = 0) {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) {
+      stop("Invalid model context");
+    }
+
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+
+    if (!edge_ctx->is_valid() || edge_ctx->ctx == nullptr || edge_ctx->model == nullptr) {
+      stop("Invalid model context or null pointers");
+    }
+
+    if (n_predict <= 0) stop("n_predict must be positive");
+    if (temperature < 0.0 || temperature > 2.0) stop("Temperature must be between 0.0 and 2.0");
+    if (top_p <= 0.0 || top_p > 1.0) stop("top_p must be between 0.0 and 1.0");
+
+    const struct llama_vocab* vocab = llama_model_get_vocab(edge_ctx->model);
+    if (!vocab) stop("Failed to get vocabulary from model");
+
+    const EdgeGrammarRef compiled = edge_resolve_grammar(grammar, grammar_root, edge_ctx->model_ref);
+    if (!compiled) {
+      stop("grammar must not be empty");
+    }
+
+    // Tokenize and process the prompt, reusing any prefix already in the KV cache
+    EdgeCallScope scope(edge_ctx.get(), timeout_seconds);
+    const std::vector<llama_token> prompt_tokens = edge_tokenize_prompt(vocab, prompt, llama_n_ctx(edge_ctx->ctx));
+    edge_decode_prompt(edge_ctx.get(), prompt_tokens);
+
+    // Build sampler chain WITH grammar constraint (grammar first, so it
+    // masks token selection)
+    bool owns_sampler = false;
+    auto * sampler = edge_acquire_sampler(sampler_ptr, edge_ctx->model_ref, compiled.get(), temperature, top_p, owns_sampler);
+    std::unique_ptr<llama_sampler, decltype(&llama_sampler_free)> owned_sampler(
+      owns_sampler ? sampler : NULL, llama_sampler_free);
+
+    // Generate tokens (only collect generated text, not prompt). Once the
+    // grammar is complete only end-of-generation remains allowed.
+    std::string result;
+    result.reserve(n_predict * 8);
+    edge_generate(edge_ctx.get(), vocab, sampler, n_predict, result,
+                  [](const char*, size_t, int) { return true; });
+
+    scope.rethrow_interrupt();
+    return result;
+
+  } catch (const std::exception& e) {
+    stop("Error during grammar completion: " + std::string(e.what()));
+  }
+}
+
+// Outcome of edge_score_continuations()
+struct EdgeScoreResult {
+  std::vector<double> logprob;  // summed log-probability of each continuation
+  std::vector<int> n_tokens;    // tokens scored for each continuation
+  int n_prompt = 0;             // tokens of the shared prompt
+  int n_reused = 0;             // of which were still in the cache
+};
+
+// Score every continuation as a completion of `prompt`: the summed
+// log-probability of its tokens. The prompt is decoded once into sequence 0
+// and copied to sequence i + 1 for continuation i through
+// llama_memory_seq_cp, then all continuations are evaluated together in
+// n_batch sized batches. Sequence 0 only ever holds the prompt, so recurrent
+// models, whose state cannot drop a partial range, can keep it as well.
+static EdgeScoreResult edge_score_continuations(EdgeModelContext* edge_ctx, const std::string& prompt,
+                                                const std::vector<std::string>& continuations) {
+  const int n_cont = (int)continuations.size();
+  const struct llama_vocab* vocab = llama_model_get_vocab(edge_ctx->model);
+  const int n_vocab = llama_vocab_n_tokens(vocab);
+  const int n_ctx = llama_n_ctx(edge_ctx->ctx);
+
+  // Tokenize prompt + continuation as one text, so tokens merging across
+  // the boundary come out as they would in generated text. The shared
+  // prefix is what all of them have in common with the prompt alone.
+  const std::vector<llama_token> prompt_tokens = edge_tokenize_prompt(vocab, prompt, n_ctx);
+  std::vector<std::vector<llama_token>> full(n_cont);
+  size_t n_prefix = prompt_tokens.size();
+  for (int i = 0; i < n_cont; ++i) {
+    full[i] = edge_tokenize_prompt(vocab, prompt + continuations[i], n_ctx);
+    size_t n_common = 0;
+    while (n_common < n_prefix && n_common < full[i].size() && full[i][n_common] == prompt_tokens[n_common]) {
+      ++n_common;
+    }
+    n_prefix = std::min(n_common, full[i].size() - 1);
+  }
+  if (n_prefix == 0) {
+    stop("prompt must not be empty");
+  }
+
+  size_t n_total = n_prefix;
+  for (int i = 0; i < n_cont; ++i) {
+    n_total += full[i].size() - n_prefix;
+  }
+
+  llama_context* ctx = edge_get_score_context(edge_ctx, n_cont + 1, (int)n_total);
+  llama_memory_t mem = llama_get_memory(ctx);
+  const int n_batch = llama_n_batch(ctx);
+
+  // Keep the part of the last prompt that matches; at least the final
+  // prefix token is decoded again for its logits
+  std::vector<llama_token>& cached = edge_ctx->score_tokens;
+  size_t n_keep = 0;
+  while (n_keep < cached.size() && n_keep + 1 < n_prefix && cached[n_keep] == full[0][n_keep]) {
+    ++n_keep;
+  }
+  bool trimmed = true;
+  for (int s = 1; s < (int)llama_n_seq_max(ctx); ++s) {
+    trimmed = llama_memory_seq_rm(mem, s, -1, -1) && trimmed;
+  }
+  if (!trimmed || !llama_memory_seq_rm(mem, 0, (llama_pos)n_keep, -1)) {
+    // Some memory types (e.g. recurrent) cannot drop a partial range
+    llama_memory_clear(mem, true);
+    n_keep = 0;
+  }
+  cached.assign(full[0].begin(), full[0].begin() + n_keep);
+
+  EdgeScoreResult res;
+  res.logprob.assign(n_cont, 0.0);
+  res.n_prompt = (int)n_prefix;
+  res.n_reused = (int)n_keep;
+
+  llama_batch batch = llama_batch_init(n_batch, 0, 1);
+  try {
+    for (size_t start = n_keep; start < n_prefix; start += n_batch) {
+      const size_t end = std::min(n_prefix, start + (size_t)n_batch);
+      batch.n_tokens = 0;
+      for (size_t k = start; k < end; ++k) {
+        const int j = batch.n_tokens++;
+        batch.token[j] = full[0][k];
+        batch.pos[j] = (llama_pos)k;
+        batch.n_seq_id[j] = 1;
+        batch.seq_id[j][0] = 0;
+        batch.logits[j] = k + 1 == n_prefix;
+      }
+      const int rc = llama_decode(ctx, batch);
+      if (rc == 2) {
+        edge_throw_stopped(edge_ctx);
+      }
+      if (rc != 0) {
+        throw std::runtime_error("Failed to decode prompt");
+      }
+      cached.insert(cached.end(), full[0].begin() + start, full[0].begin() + end);
+    }
+
+    // The first token of every continuation is scored on the prompt's logits
+    const float* prefix_logits = llama_get_logits_ith(ctx, batch.n_tokens - 1);
+    for (int i = 0; i < n_cont; ++i) {
+      res.logprob[i] += edge_token_logprob(prefix_logits, n_vocab, full[i][n_prefix]);
+    }
+    for (int i = 0; i < n_cont; ++i) {
+      llama_memory_seq_cp(mem, 0, i + 1, -1, -1);
+    }
+
+    // Each remaining token is scored on the logits of the one before it
+    std::vector<std::pair<int, size_t>> pending;  // (continuation, index of the token decoded)
+    for (int i = 0; i < n_cont; ++i) {
+      for (size_t k = n_prefix; k + 1 < full[i].size(); ++k) {
+        pending.emplace_back(i, k);
+      }
+    }
+    for (size_t start = 0; start < pending.size(); start += n_batch) {
+      const size_t end = std::min(pending.size(), start + (size_t)n_batch);
+      batch.n_tokens = 0;
+      for (size_t e = start; e < end; ++e) {
+        const int j = batch.n_tokens++;
+        batch.token[j] = full[pending[e].first][pending[e].second];
+        batch.pos[j] = (llama_pos)pending[e].second;
+        batch.n_seq_id[j] = 1;
+        batch.seq_id[j][0] = pending[e].first + 1;
+        batch.logits[j] = true;
+      }
+      const int rc = llama_decode(ctx, batch);
+      if (rc == 2) {
+        edge_throw_stopped(edge_ctx);
+      }
+      if (rc != 0) {
+        throw std::runtime_error("Failed to decode continuations");
+      }
+      for (size_t e = start; e < end; ++e) {
+        const int i = pending[e].first;
+        const float* logits = llama_get_logits_ith(ctx, (int32_t)(e - start));
+        res.logprob[i] += edge_token_logprob(logits, n_vocab, full[i][pending[e].second + 1]);
+      }
+    }
+  } catch (...) {
+    llama_batch_free(batch);
+    cached.clear();
+    llama_memory_clear(mem, true);
+    throw;
+  }
+  llama_batch_free(batch);
+
+  // Leave only the prompt in the cache for the next call
+  for (int i = 0; i < n_cont; ++i) {
+    if (!llama_memory_seq_rm(mem, i + 1, -1, -1)) {
+      cached.clear();
+      llama_memory_clear(mem, true);
+      break;
+    }
+  }
+
+  res.n_tokens.resize(n_cont);
+  for (int i = 0; i < n_cont; ++i) {
+    res.n_tokens[i] = (int)(full[i].size() - n_prefix);
+  }
+  return res;
+}
+
+// [[Rcpp::export]]
+List edge_score_internal(SEXP model_ptr, std::string prompt, std::vector<std::string> continuations) {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) {
+      stop("Invalid model context");
+    }
+
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+
+    if (!edge_ctx->is_valid() || edge_ctx->ctx == nullptr || edge_ctx->model == nullptr) {
+      stop("Invalid model context or null pointers");
+    }
+
+    if (continuations.empty()) stop("continuations must not be empty");
+    // One sequence per continuation, plus the prompt's
+    if (continuations.size() > 255) stop("At most 255 continuations can be scored at once");
+    for (const std::string& c : continuations) {
+      if (c.empty()) stop("continuations must not be empty strings");
+    }
+
+    EdgeCallScope scope(edge_ctx.get());
+    const EdgeScoreResult res = edge_score_continuations(edge_ctx.get(), prompt, continuations);
+    return List::create(
+      Named("logprob") = res.logprob,
+      Named("n_tokens") = res.n_tokens,
+      Named("prompt_tokens") = res.n_prompt,
+      Named("reused_tokens") = res.n_reused
+    );
+
+  } catch (const std::exception& e) {
+    stop("Error during scoring: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+CharacterVector edge_completion_batch_internal(SEXP model_ptr, std::vector<std::string> prompts, int n_predict = 128, double temperature = 0.8, double top_p = 0.95, SEXP grammar = R_NilValue, std::string grammar_root = "root", int n_parallel = 8) {
   try {
     if (TYPEOF(model_ptr) != EXTPTRSXP) {
       stop("Invalid model context");
@@ -564,96 +2647,447 @@ std::string edge_completion_grammar_internal(SEXP model_ptr, std::string prompt,
       stop("Invalid model context or null pointers");
     }
 
+    if (prompts.empty()) stop("prompts must not be empty");
     if (n_predict <= 0) stop("n_predict must be positive");
     if (temperature < 0.0 || temperature > 2.0) stop("Temperature must be between 0.0 and 2.0");
     if (top_p <= 0.0 || top_p > 1.0) stop("top_p must be between 0.0 and 1.0");
+    if (n_parallel <= 0) stop("n_parallel must be positive");
 
     const struct llama_vocab* vocab = llama_model_get_vocab(edge_ctx->model);
     if (!vocab) stop("Failed to get vocabulary from model");
 
-    // Tokenize
-    const int n_prompt_tokens = -llama_tokenize(vocab, prompt.c_str(), (int32_t)prompt.size(), NULL, 0, true, true);
-    if (n_prompt_tokens <= 0) stop("Failed to determine prompt token count");
+    const int n_prompts = static_cast<int>(prompts.size());
+    CharacterVector results(n_prompts);
+
+    // Tokenize everything up front; prompts that do not fit are reported as NA
+    const int n_ctx = llama_n_ctx(edge_ctx->ctx);
+    std::vector<std::vector<llama_token>> prompt_tokens(n_prompts);
+    std::vector<int> pending;
+    int max_prompt_tokens = 0;
+    for (int p = 0; p < n_prompts; ++p) {
+      const std::string& prompt = prompts[p];
+      const int n_tokens = -llama_tokenize(vocab, prompt.c_str(), (int32_t)prompt.size(), NULL, 0, true, true);
+      if (n_tokens > 0) {
+        prompt_tokens[p].resize(n_tokens);
+        if (llama_tokenize(vocab, prompt.c_str(), (int32_t)prompt.size(), prompt_tokens[p].data(), n_tokens, true, true) < 0) {
+          prompt_tokens[p].clear();
+        }
+      }
+      if (prompt_tokens[p].empty()) {
+        warning("Failed to tokenize prompt at index " + std::to_string(p + 1) + ", returning NA");
+        results[p] = NA_STRING;
+      } else if ((int)prompt_tokens[p].size() >= n_ctx) {
+        warning("Prompt at index " + std::to_string(p + 1) + " too long (" + std::to_string(prompt_tokens[p].size()) +
+                " tokens) for context size (" + std::to_string(n_ctx) + "), returning NA");
+        results[p] = NA_STRING;
+      } else {
+        max_prompt_tokens = std::max(max_prompt_tokens, (int)prompt_tokens[p].size());
+        pending.push_back(p);
+      }
+    }
+    if (pending.empty()) {
+      return results;
+    }
+
+    // Every prompt gets its own sampler chain over a copy of the same grammar
+    const EdgeGrammarRef compiled = Rf_isNull(grammar) ? EdgeGrammarRef() : edge_resolve_grammar(grammar, grammar_root, edge_ctx->model_ref);
+
+    const int n_seq = std::min({n_parallel, (int)pending.size(), 64});
+    const int n_ctx_seq = std::min(n_ctx, max_prompt_tokens + n_predict);
+    EdgeBatchEngine engine(edge_get_batch_context(edge_ctx.get(), n_seq, n_ctx_seq), vocab);
+
+    size_t next_pending = 0;
+    auto on_done = [&](EdgeBatchEngine::slot& slot) {
+      results[slot.request] = slot.text;
+    };
+    EdgeCallScope scope(edge_ctx.get());
+    while (true) {
+      // A stopped call keeps what the started prompts generated so far
+      if (edge_abort_callback(edge_ctx.get())) {
+        engine.finish_all(edge_stop_name(edge_ctx->stop_reason), on_done);
+        break;
+      }
+
+      // Hand waiting prompts to free slots
+      int s;
+      while (next_pending < pending.size() && (s = engine.free_slot()) >= 0) {
+        const int p = pending[next_pending++];
+        llama_sampler* sampler = edge_make_sampler(compiled.get(), temperature, top_p);
+        engine.assign(s, p, std::move(prompt_tokens[p]), n_predict, sampler);
+      }
+      if (engine.n_active() == 0) break;
+
+      if (!engine.step(on_done)) {
+        engine.finish_all(edge_stop_name(edge_ctx->stop_reason), on_done);
+        break;
+      }
+    }
+    scope.rethrow_interrupt();
+
+    // Prompts the call never started to work on
+    for (size_t i = next_pending; i < pending.size(); ++i) {
+      results[pending[i]] = NA_STRING;
+    }
+    return results;
+
+  } catch (const std::exception& e) {
+    stop("Error during batch completion: " + std::string(e.what()));
+  }
+}
+
+// Native serving loop behind edge_serve(). A worker thread owns a
+// multi-sequence context and an EdgeBatchEngine; requests are queued from
+// the R thread and picked up at the next token boundary, so concurrent
+// clients share decode steps instead of waiting for each other. The worker
+// never calls into R: finished requests are stored until R collects them.
+struct EdgeServer {
+  struct job {
+    int64_t id;
+    std::vector<llama_token> tokens;
+    int n_predict;
+    llama_sampler* sampler;
+  };
+
+  struct result {
+    std::string text;
+    int prompt_tokens = 0;
+    int completion_tokens = 0;
+    std::string finish_reason;
+    std::string error;
+  };
+
+  EdgeModelContext* edge_ctx = NULL;
+  llama_context* ctx = NULL;
+  const llama_vocab* vocab = NULL;
+  std::unique_ptr<EdgeBatchEngine> engine;
+
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<job> queue;
+  std::map<int64_t, result> results;
+  std::set<int64_t> cancelled;  // requests to cancel at the next token boundary
+  bool cancel_all = false;
+  int64_t next_id = 1;
+  int n_active = 0;
+  bool stopping = false;
+
+  EdgeServer() = default;
+  EdgeServer(const EdgeServer&) = delete;
+  EdgeServer& operator=(const EdgeServer&) = delete;
+
+  ~EdgeServer() {
+    shutdown();
+  }
+
+  bool is_running() const {
+    return ctx != NULL;
+  }
+
+  void start() {
+    worker = std::thread([this]() { run(); });
+  }
+
+  // Stop the worker and release the context; queued and running requests
+  // are dropped. Safe to call more than once.
+  void shutdown() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    cv.notify_all();
+    if (worker.joinable()) {
+      worker.join();
+    }
+    for (auto& j : queue) {
+      llama_sampler_free(j.sampler);
+    }
+    queue.clear();
+    engine.reset();
+    if (ctx) {
+      llama_free(ctx);
+      ctx = NULL;
+    }
+    if (edge_ctx && edge_ctx->server == this) {
+      edge_ctx->server = NULL;
+    }
+    edge_ctx = NULL;
+  }
+
+  int64_t submit(std::vector<llama_token> tokens, int n_predict, llama_sampler* sampler) {
+    int64_t id;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      id = next_id++;
+      queue.push_back(job{id, std::move(tokens), n_predict, sampler});
+    }
+    cv.notify_one();
+    return id;
+  }
+
+  // Ask the worker to cancel request `id`, or every queued and running
+  // request when `id` is negative. A running request finishes with the text
+  // it has so far; unknown and finished requests are ignored.
+  void cancel(int64_t id) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (id < 0) {
+        cancel_all = true;
+      } else {
+        cancelled.insert(id);
+      }
+    }
+    cv.notify_one();
+  }
+
+private:
+  void store(EdgeBatchEngine::slot& sl, const std::string& error) {
+    result r;
+    r.text = sl.text;
+    r.prompt_tokens = (int)sl.n_prompt;
+    r.completion_tokens = sl.n_generated;
+    r.finish_reason = sl.finish_reason;
+    r.error = error;
+    std::lock_guard<std::mutex> lock(mutex);
+    results[sl.request] = std::move(r);
+  }
+
+  void run() {
+    auto on_done = [this](EdgeBatchEngine::slot& sl) { store(sl, ""); };
+
+    while (true) {
+      std::vector<int64_t> cancel_ids;
+      bool cancel_running = false;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() {
+          return stopping || !queue.empty() || engine->n_active() > 0 || cancel_all || !cancelled.empty();
+        });
+        if (stopping) {
+          break;
+        }
+
+        // Cancelled requests that are still queued never start
+        for (auto it = queue.begin(); it != queue.end();) {
+          if (cancel_all || cancelled.count(it->id)) {
+            result r;
+            r.prompt_tokens = (int)it->tokens.size();
+            r.finish_reason = "cancelled";
+            results[it->id] = std::move(r);
+            llama_sampler_free(it->sampler);
+            it = queue.erase(it);
+          } else {
+            ++it;
+          }
+        }
+        cancel_ids.assign(cancelled.begin(), cancelled.end());
+        cancel_running = cancel_all;
+        cancelled.clear();
+        cancel_all = false;
+      }
+
+      // store() takes the lock
+      if (cancel_running) {
+        engine->finish_all("cancelled", on_done);
+      }
+      for (int64_t id : cancel_ids) {
+        engine->cancel(id, on_done);
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        int s;
+        while (!queue.empty() && (s = engine->free_slot()) >= 0) {
+          job j = std::move(queue.front());
+          queue.pop_front();
+          engine->assign(s, j.id, std::move(j.tokens), j.n_predict, j.sampler);
+        }
+        n_active = engine->n_active();
+      }
+
+      try {
+        engine->step(on_done);
+      } catch (const std::exception& e) {
+        const std::string error = e.what();
+        engine->finish_all("error", [&](EdgeBatchEngine::slot& sl) { store(sl, error); });
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      n_active = engine->n_active();
+    }
+  }
+};
+
+static void edge_server_shutdown(EdgeServer* server) {
+  server->shutdown();
+}
+
+static EdgeServer* edge_server_get(SEXP server_ptr) {
+  if (TYPEOF(server_ptr) != EXTPTRSXP) {
+    stop("Invalid server handle");
+  }
+  XPtr<EdgeServer> server(server_ptr);
+  if (server.get() == nullptr || !server->is_running()) {
+    stop("Server is not running");
+  }
+  return server.get();
+}
+
+// [[Rcpp::export]]
+SEXP edge_server_start_internal(SEXP model_ptr, int n_parallel = 4, int n_ctx_seq = 0) {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) {
+      stop("Invalid model context");
+    }
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    if (!edge_ctx->is_valid()) {
+      stop("Invalid model context");
+    }
+    if (edge_ctx->server) {
+      stop("A server is already running on this model");
+    }
+    if (n_parallel <= 0 || n_parallel > 64) {
+      stop("n_parallel must be between 1 and 64");
+    }
+    if (n_ctx_seq <= 0) {
+      n_ctx_seq = (int)llama_n_ctx(edge_ctx->ctx);
+    }
+
+    // The server decodes on its own thread, concurrently with R, so it does
+    // not share the model's threadpools, nor its abort callback: edge_cancel()
+    // on the server cancels single requests instead
+    auto server = std::make_unique<EdgeServer>();
+    server->ctx = edge_new_seq_context(edge_ctx.get(), n_parallel, n_ctx_seq);
+    if (!server->ctx) {
+      stop("Failed to create server context");
+    }
+    server->edge_ctx = edge_ctx.get();
+    server->vocab = llama_model_get_vocab(edge_ctx->model);
+    server->engine = std::make_unique<EdgeBatchEngine>(server->ctx, server->vocab);
+    server->start();
+    edge_ctx->server = server.get();
+
+    // The model handle is kept alive for as long as the server handle
+    XPtr<EdgeServer> ptr(server.release(), true, R_NilValue, model_ptr);
+    ptr.attr("class") = "edge_server";
+    return ptr;
+  } catch (const std::exception& e) {
+    stop("Error starting server: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+double edge_server_submit_internal(SEXP server_ptr, std::string prompt, int n_predict = 128, double temperature = 0.8, double top_p = 0.95, std::string grammar_str = "", std::string grammar_root = "root") {
+  try {
+    EdgeServer* server = edge_server_get(server_ptr);
+
+    if (n_predict <= 0) stop("n_predict must be positive");
+    if (temperature < 0.0 || temperature > 2.0) stop("Temperature must be between 0.0 and 2.0");
+    if (top_p <= 0.0 || top_p > 1.0) stop("top_p must be between 0.0 and 1.0");
 
-    std::vector<llama_token> prompt_tokens(n_prompt_tokens);
-    if (llama_tokenize(vocab, prompt.c_str(), (int32_t)prompt.size(), prompt_tokens.data(), (int32_t)prompt_tokens.size(), true, true) < 0) {
+    const llama_vocab* vocab = server->vocab;
+    const int n_tokens = -llama_tokenize(vocab, prompt.c_str(), (int32_t)prompt.size(), NULL, 0, true, true);
+    std::vector<llama_token> tokens(std::max(n_tokens, 0));
+    if (n_tokens <= 0 ||
+        llama_tokenize(vocab, prompt.c_str(), (int32_t)prompt.size(), tokens.data(), n_tokens, true, true) < 0) {
       stop("Failed to tokenize prompt");
     }
-
-    // Validate prompt fits in context window
-    int n_ctx = llama_n_ctx(edge_ctx->ctx);
-    if (n_prompt_tokens >= n_ctx) {
-      stop("Prompt too long (" + std::to_string(n_prompt_tokens) + " tokens) for context size (" +
-           std::to_string(n_ctx) + "). Shorten the prompt or increase n_ctx in edge_load_model().");
+    const int n_ctx_seq = (int)llama_n_ctx_seq(server->ctx);
+    if (n_tokens >= n_ctx_seq) {
+      stop("Prompt too long (" + std::to_string(n_tokens) + " tokens) for context size (" +
+           std::to_string(n_ctx_seq) + ")");
     }
 
-    // Process prompt
-    llama_batch batch = llama_batch_get_one(prompt_tokens.data(), (int32_t)prompt_tokens.size());
-    if (llama_decode(edge_ctx->ctx, batch)) stop("Failed to process prompt");
-
-    // Build sampler chain WITH grammar constraint
-    auto sampler_chain_params = llama_sampler_chain_default_params();
-    auto * sampler = llama_sampler_chain_init(sampler_chain_params);
-
-    // Add grammar sampler first (constrains token selection)
+    EdgeGrammarRef compiled;
     if (!grammar_str.empty()) {
-      auto * grammar_sampler = llama_sampler_init_grammar(vocab, grammar_str.c_str(), grammar_root.c_str());
-      if (!grammar_sampler) {
-        llama_sampler_free(sampler);
+      compiled = edge_compile_grammar(server->edge_ctx->model_ref, grammar_str, grammar_root);
+      if (!compiled) {
         stop("Failed to parse GBNF grammar. Check grammar syntax.");
       }
-      llama_sampler_chain_add(sampler, grammar_sampler);
     }
+    llama_sampler* sampler = edge_make_sampler(compiled.get(), temperature, top_p);
 
-    // Add standard samplers
-    if (top_p < 1.0f) {
-      llama_sampler_chain_add(sampler, llama_sampler_init_top_p(static_cast<float>(top_p), 1));
-    }
-    if (temperature > 0.0f) {
-      llama_sampler_chain_add(sampler, llama_sampler_init_temp(static_cast<float>(temperature)));
+    return (double)server->submit(std::move(tokens), n_predict, sampler);
+  } catch (const std::exception& e) {
+    stop("Error submitting request: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+SEXP edge_server_result_internal(SEXP server_ptr, double id) {
+  try {
+    EdgeServer* server = edge_server_get(server_ptr);
+
+    EdgeServer::result r;
+    {
+      std::lock_guard<std::mutex> lock(server->mutex);
+      auto it = server->results.find((int64_t)id);
+      if (it == server->results.end()) {
+        return R_NilValue;
+      }
+      r = std::move(it->second);
+      server->results.erase(it);
     }
-    llama_sampler_chain_add(sampler, llama_sampler_init_dist(12345));
 
-    // Generate tokens (only collect generated text, not prompt)
-    std::string result;
-    result.reserve(n_predict * 8);
+    return List::create(
+      Named("text") = r.text,
+      Named("prompt_tokens") = r.prompt_tokens,
+      Named("completion_tokens") = r.completion_tokens,
+      Named("finish_reason") = r.finish_reason,
+      Named("error") = r.error
+    );
+  } catch (const std::exception& e) {
+    stop("Error getting result: " + std::string(e.what()));
+  }
+}
 
-    for (int i = 0; i < n_predict; ++i) {
-      llama_token new_token = llama_sampler_sample(sampler, edge_ctx->ctx, -1);
+// [[Rcpp::export]]
+void edge_server_cancel_internal(SEXP server_ptr, double id = -1) {
+  try {
+    edge_server_get(server_ptr)->cancel((int64_t)id);
+  } catch (const std::exception& e) {
+    stop("Error cancelling request: " + std::string(e.what()));
+  }
+}
 
-      if (llama_vocab_is_eog(vocab, new_token)) break;
+// [[Rcpp::export]]
+List edge_server_stats_internal(SEXP server_ptr) {
+  try {
+    EdgeServer* server = edge_server_get(server_ptr);
 
-      std::vector<char> piece(512);
-      int n_chars = llama_token_to_piece(vocab, new_token, piece.data(), static_cast<int32_t>(piece.size()), 0, true);
-      if (n_chars < 0) {
-        piece.resize(static_cast<size_t>(std::abs(n_chars)) + 1);
-        n_chars = llama_token_to_piece(vocab, new_token, piece.data(), static_cast<int32_t>(piece.size()), 0, true);
-      }
-      if (n_chars > 0) {
-        result.append(piece.data(), n_chars);
-      }
+    std::lock_guard<std::mutex> lock(server->mutex);
+    return List::create(
+      Named("n_parallel") = (int)llama_n_seq_max(server->ctx),
+      Named("n_ctx_seq") = (int)llama_n_ctx_seq(server->ctx),
+      Named("n_active") = server->n_active,
+      Named("n_queued") = (int)server->queue.size()
+    );
+  } catch (const std::exception& e) {
+    stop("Error getting server statistics: " + std::string(e.what()));
+  }
+}
 
-      try {
-        llama_sampler_accept(sampler, new_token);
-      } catch (const std::exception &) {
-        // Grammar fully satisfied by this token — no further tokens are allowed.
-        // The token's text is already in `result`; stop generating cleanly.
-        break;
-      }
-      batch = llama_batch_get_one(&new_token, 1);
-      if (llama_decode(edge_ctx->ctx, batch)) break;
+// [[Rcpp::export]]
+void edge_server_stop_internal(SEXP server_ptr) {
+  try {
+    if (TYPEOF(server_ptr) != EXTPTRSXP) {
+      warning("Invalid server handle");
+      return;
+    }
+    XPtr<EdgeServer> server(server_ptr);
+    if (server.get() != nullptr) {
+      server->shutdown();
     }
-
-    llama_sampler_free(sampler);
-    return result;
-
   } catch (const std::exception& e) {
-    stop("Error during grammar completion: " + std::string(e.what()));
+    warning("Error stopping server: " + std::string(e.what()));
   }
 }
 
 // [[Rcpp::export]]
 NumericMatrix edge_embeddings_internal(SEXP model_ptr, std::vector<std::string> texts, bool normalize = true) {
+  struct llama_batch batch = {};
+  bool batch_allocated = false;
+
   try {
     if (TYPEOF(model_ptr) != EXTPTRSXP) {
       stop("Invalid model context");
@@ -676,109 +3110,692 @@ NumericMatrix edge_embeddings_internal(SEXP model_ptr, std::vector<std::string>
     const int n_texts = static_cast<int>(texts.size());
     NumericMatrix result(n_texts, n_embd);
 
-    for (int t = 0; t < n_texts; ++t) {
-      // Clear KV cache between texts
-      llama_memory_t mem = llama_get_memory(edge_ctx->ctx);
-      if (mem) {
-        llama_memory_clear(mem, true);
-      }
+    // Nothing to extract unless the model was loaded with embeddings = TRUE;
+    // the R wrapper warns about the all-zero result
+    if (!edge_ctx->ctx_params.embeddings) {
+      return result;
+    }
 
-      // Tokenize
+    // Tokenize everything up front, truncating to the context size
+    const int n_ctx = llama_n_ctx(edge_ctx->ctx);
+    std::vector<std::vector<llama_token>> tokens(n_texts);
+    int max_tokens = 0;
+    for (int t = 0; t < n_texts; ++t) {
       const std::string& text = texts[t];
       const int n_tokens = -llama_tokenize(vocab, text.c_str(), (int32_t)text.size(), NULL, 0, true, true);
       if (n_tokens <= 0) {
         warning("Failed to tokenize text at index " + std::to_string(t + 1) + ", skipping");
         continue;
       }
-
-      std::vector<llama_token> tokens(n_tokens);
-      if (llama_tokenize(vocab, text.c_str(), (int32_t)text.size(), tokens.data(), (int32_t)tokens.size(), true, true) < 0) {
+      tokens[t].resize(n_tokens);
+      if (llama_tokenize(vocab, text.c_str(), (int32_t)text.size(), tokens[t].data(), (int32_t)tokens[t].size(), true, true) < 0) {
         warning("Failed to tokenize text at index " + std::to_string(t + 1) + ", skipping");
+        tokens[t].clear();
         continue;
       }
+      if (n_tokens > n_ctx) {
+        tokens[t].resize(n_ctx);
+      }
+      max_tokens = std::max(max_tokens, (int)tokens[t].size());
+    }
+    if (max_tokens == 0) {
+      return result;
+    }
 
-      // Check if context size is sufficient
-      int n_ctx = llama_n_ctx(edge_ctx->ctx);
-      int tokens_to_process = std::min(n_tokens, n_ctx);
+    // Texts are packed into one batch under distinct sequence ids, up to
+    // n_batch tokens per pack; a text longer than that gets a pack of its own
+    const int n_pack_tokens = std::max<int>(edge_ctx->ctx_params.n_batch, max_tokens);
+    const int n_seq = std::min(n_texts, 64);
+    llama_context* ctx = edge_get_embedding_context(edge_ctx.get(), n_seq, n_pack_tokens);
+    llama_memory_t mem = llama_get_memory(ctx);
+    EdgeCallScope scope(edge_ctx.get());
+    const bool pooled = llama_pooling_type(ctx) != LLAMA_POOLING_TYPE_NONE;
+    const bool has_encoder = llama_model_has_encoder(edge_ctx->model);
+
+    batch = llama_batch_init(n_pack_tokens, 0, 1);
+    batch_allocated = true;
+
+    std::vector<int> pack_text;   // text index of each sequence in the pack
+    std::vector<int> pack_last;   // batch index of each sequence's last token
+
+    int next = 0;
+    while (next < n_texts) {
+      pack_text.clear();
+      pack_last.clear();
+      batch.n_tokens = 0;
+
+      while (next < n_texts && (int)pack_text.size() < n_seq) {
+        const std::vector<llama_token>& text_tokens = tokens[next];
+        if (text_tokens.empty()) {
+          ++next;
+          continue;
+        }
+        if (batch.n_tokens + (int)text_tokens.size() > n_pack_tokens) {
+          break;
+        }
+        const llama_seq_id seq_id = (llama_seq_id)pack_text.size();
+        for (size_t i = 0; i < text_tokens.size(); ++i) {
+          const int j = batch.n_tokens++;
+          batch.token[j] = text_tokens[i];
+          batch.pos[j] = (llama_pos)i;
+          batch.n_seq_id[j] = 1;
+          batch.seq_id[j][0] = seq_id;
+          batch.logits[j] = 1;
+        }
+        pack_text.push_back(next);
+        pack_last.push_back(batch.n_tokens - 1);
+        ++next;
+      }
+      if (pack_text.empty()) {
+        break;
+      }
 
-      // Create batch with tokens requesting output
-      struct llama_batch batch = llama_batch_init(tokens_to_process, 0, 1);
-      batch.n_tokens = tokens_to_process;
-      for (int i = 0; i < tokens_to_process; ++i) {
-        batch.token[i] = tokens[i];
-        batch.pos[i] = i;
-        batch.n_seq_id[i] = 1;
-        batch.seq_id[i][0] = 0;
-        batch.logits[i] = 1;  // request output for all tokens (needed for embeddings)
+      if (mem) {
+        llama_memory_clear(mem, true);
       }
 
       // Use encode for encoder models, decode for decoder-only (generative) models
-      bool has_encoder = llama_model_has_encoder(edge_ctx->model);
-      int rc;
-      if (has_encoder) {
-        rc = llama_encode(edge_ctx->ctx, batch);
-      } else {
-        rc = llama_decode(edge_ctx->ctx, batch);
+      const int rc = has_encoder ? llama_encode(ctx, batch) : llama_decode(ctx, batch);
+      if (rc == 2) {
+        llama_batch_free(batch);
+        batch_allocated = false;
+        edge_throw_stopped(edge_ctx.get());
       }
       if (rc != 0) {
-        llama_batch_free(batch);
-        warning("Failed to process text at index " + std::to_string(t + 1) + ", skipping");
+        for (int t : pack_text) {
+          warning("Failed to process text at index " + std::to_string(t + 1) + ", skipping");
+        }
         continue;
       }
 
-      // Get embeddings - strategy depends on pooling type
-      const float* embd = nullptr;
+      for (size_t s = 0; s < pack_text.size(); ++s) {
+        const int t = pack_text[s];
 
-      enum llama_pooling_type pooling = llama_pooling_type(edge_ctx->ctx);
-      if (pooling != LLAMA_POOLING_TYPE_NONE) {
-        // Pooled models: get sequence-level embedding
-        embd = llama_get_embeddings_seq(edge_ctx->ctx, 0);
-      }
-      if (!embd) {
-        // Decoder-only / no pooling: get last token embedding
-        embd = llama_get_embeddings_ith(edge_ctx->ctx, tokens_to_process - 1);
-      }
-      if (!embd) {
-        // Final fallback: get all embeddings (first position)
-        embd = llama_get_embeddings(edge_ctx->ctx);
-      }
+        // Pooled models: sequence-level embedding; otherwise the embedding of
+        // the sequence's last token
+        const float* embd = nullptr;
+        if (pooled) {
+          embd = llama_get_embeddings_seq(ctx, (llama_seq_id)s);
+        }
+        if (!embd) {
+          embd = llama_get_embeddings_ith(ctx, pack_last[s]);
+        }
+        if (!embd) {
+          warning("Failed to extract embeddings for text at index " + std::to_string(t + 1));
+          continue;
+        }
 
-      if (embd) {
+        double norm = 1.0;
         if (normalize) {
           // L2 normalize
-          double norm = 0.0;
+          norm = 0.0;
           for (int i = 0; i < n_embd; ++i) {
             norm += static_cast<double>(embd[i]) * static_cast<double>(embd[i]);
           }
           norm = std::sqrt(norm);
-          if (norm > 0.0) {
-            for (int i = 0; i < n_embd; ++i) {
-              result(t, i) = static_cast<double>(embd[i]) / norm;
-            }
-          } else {
-            for (int i = 0; i < n_embd; ++i) {
-              result(t, i) = 0.0;
-            }
-          }
-        } else {
+        }
+        if (norm > 0.0) {
           for (int i = 0; i < n_embd; ++i) {
-            result(t, i) = static_cast<double>(embd[i]);
+            result(t, i) = static_cast<double>(embd[i]) / norm;
           }
         }
-      } else {
-        warning("Failed to extract embeddings for text at index " + std::to_string(t + 1));
       }
-
-      llama_batch_free(batch);
     }
 
+    llama_batch_free(batch);
     return result;
 
   } catch (const std::exception& e) {
+    if (batch_allocated) {
+      llama_batch_free(batch);
+    }
     stop("Error during embedding extraction: " + std::string(e.what()));
   }
 }
 
+// [[Rcpp::export]]
+List edge_context_stats_internal(SEXP model_ptr) {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) stop("Invalid model context");
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    if (!edge_ctx->is_valid()) stop("Invalid model context");
+
+    return List::create(
+      Named("prompt_tokens") = edge_ctx->last_prompt_tokens,
+      Named("reused_tokens") = edge_ctx->last_reused_tokens,
+      Named("generated_tokens") = edge_ctx->last_generated_tokens,
+      Named("cached_tokens") = (int)edge_ctx->cached_tokens.size(),
+      Named("n_ctx") = (int)llama_n_ctx(edge_ctx->ctx),
+      Named("cache_type_k") = std::string(ggml_type_name(edge_ctx->ctx_params.type_k)),
+      Named("cache_type_v") = std::string(ggml_type_name(edge_ctx->ctx_params.type_v)),
+      Named("kv_cache_bytes") = edge_kv_cache_bytes(edge_ctx->ctx),
+      Named("finish_reason") = edge_ctx->last_finish_reason,
+      Named("draft_tokens") = edge_ctx->last_draft_tokens,
+      Named("accepted_tokens") = edge_ctx->last_accepted_tokens,
+      Named("acceptance_rate") = edge_ctx->last_draft_tokens > 0
+        ? (double)edge_ctx->last_accepted_tokens / edge_ctx->last_draft_tokens : NA_REAL
+    );
+  } catch (const std::exception& e) {
+    stop("Error getting context statistics: " + std::string(e.what()));
+  }
+}
+
+// Why the draft model cannot propose tokens to the target model, or an empty
+// string if it can. Token ids pass between the two unchanged, so the
+// vocabularies must agree apart from a few extra tokens at the end.
+static std::string edge_draft_incompatibility(const llama_vocab* target, const llama_vocab* draft) {
+  if (llama_vocab_type(target) != llama_vocab_type(draft)) {
+    return "the tokenizer types differ";
+  }
+  if (llama_vocab_bos(target) != llama_vocab_bos(draft) || llama_vocab_eos(target) != llama_vocab_eos(draft) ||
+      llama_vocab_get_add_bos(target) != llama_vocab_get_add_bos(draft)) {
+    return "the special tokens differ";
+  }
+  const int n_target = llama_vocab_n_tokens(target);
+  const int n_draft = llama_vocab_n_tokens(draft);
+  if (std::abs(n_target - n_draft) > 128) {
+    return "the vocabulary sizes differ (" + std::to_string(n_target) + " and " + std::to_string(n_draft) + " tokens)";
+  }
+  for (int id = 0; id < std::min(n_target, n_draft); ++id) {
+    if (std::strcmp(llama_vocab_get_text(target, id), llama_vocab_get_text(draft, id)) != 0) {
+      return "token " + std::to_string(id) + " differs";
+    }
+  }
+  return "";
+}
+
+// [[Rcpp::export]]
+void edge_speculative_internal(SEXP model_ptr, SEXP draft_ptr, int n_draft = 8, int lookup_ngram = 0) {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) stop("Invalid model context");
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    if (!edge_ctx->is_valid()) stop("Invalid model context");
+
+    edge_ctx->draft = NULL;
+    edge_ctx->n_draft = 0;
+    edge_ctx->lookup_ngram = 0;
+    R_SetExternalPtrProtected(model_ptr, R_NilValue);
+    if (Rf_isNull(draft_ptr) && lookup_ngram <= 0) {
+      return;
+    }
+
+    // The target decodes the sampled token and the whole draft in one batch
+    const int n_max = (int)llama_n_batch(edge_ctx->ctx) - 1;
+    if (n_draft < 1 || n_draft > n_max) {
+      stop("n_draft must be between 1 and " + std::to_string(n_max));
+    }
+    // Both modes roll rejected drafts back the same way
+    if (!edge_can_drop_draft(edge_ctx->model)) {
+      stop("Speculative decoding is not supported for recurrent or hybrid models");
+    }
+    if (lookup_ngram > 0) {
+      edge_ctx->n_draft = n_draft;
+      edge_ctx->lookup_ngram = lookup_ngram;
+      return;
+    }
+
+    if (TYPEOF(draft_ptr) != EXTPTRSXP) stop("Invalid draft model context");
+    XPtr<EdgeModelContext> draft(draft_ptr);
+    if (!draft->is_valid()) stop("Invalid draft model context");
+    if (draft.get() == edge_ctx.get()) stop("A model context cannot be its own draft");
+    if (!edge_can_drop_draft(draft->model)) {
+      stop("The draft model cannot be a recurrent or hybrid model");
+    }
+    const std::string why = edge_draft_incompatibility(llama_model_get_vocab(edge_ctx->model),
+                                                       llama_model_get_vocab(draft->model));
+    if (!why.empty()) {
+      stop("The draft model's vocabulary does not match: " + why);
+    }
+
+    edge_ctx->draft = draft.get();
+    edge_ctx->n_draft = n_draft;
+    // The draft's handle lives at least as long as this context's
+    R_SetExternalPtrProtected(model_ptr, draft_ptr);
+  } catch (const std::exception& e) {
+    stop("Error setting up speculative decoding: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+void edge_cancel_internal(SEXP model_ptr) {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) stop("Invalid model context");
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    if (!edge_ctx->is_valid()) stop("Invalid model context");
+
+    // Picked up at the next graph node or token of the running call
+    edge_ctx->stop_reason = EDGE_STOP_CANCELLED;
+  } catch (const std::exception& e) {
+    stop("Error cancelling generation: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+void edge_context_clear_internal(SEXP model_ptr) {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) stop("Invalid model context");
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    if (!edge_ctx->is_valid()) stop("Invalid model context");
+
+    llama_memory_t mem = llama_get_memory(edge_ctx->ctx);
+    if (mem) {
+      llama_memory_clear(mem, true);
+    }
+    edge_ctx->cached_tokens.clear();
+  } catch (const std::exception& e) {
+    stop("Error clearing context: " + std::string(e.what()));
+  }
+}
+
+// Timings of one benchmark run, in milliseconds
+struct EdgeBenchRun {
+  double prompt_ms = 0.0;
+  double decode_ms = 0.0;
+  double sample_ms = 0.0;
+  double ttft_ms = 0.0;
+};
+
+// [[Rcpp::export]]
+DataFrame edge_benchmark_internal(SEXP model_ptr, std::vector<int> n_prompt, std::vector<int> n_gen,
+                                  std::vector<int> n_batch, std::vector<int> n_threads,
+                                  int repetitions = 3, std::string prompt = "") {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) stop("Invalid model context");
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    if (!edge_ctx->is_valid()) stop("Invalid model context");
+
+    llama_context* ctx = edge_ctx->ctx;
+    const llama_vocab* vocab = llama_model_get_vocab(edge_ctx->model);
+    const int n_ctx = (int)llama_n_ctx(ctx);
+    const int max_batch = (int)llama_n_batch(ctx);
+    // llama_decode() computes in micro-batches of n_ubatch, fixed when the
+    // context was created: larger chunks would time the same graphs
+    const int max_ubatch = (int)llama_n_ubatch(ctx);
+    const llama_context_params& params = edge_ctx->ctx_params;
+
+    // A text prompt is benchmarked as is; otherwise prompts of each length are
+    // random tokens, like llama-bench, so no prefix can be reused
+    std::vector<std::vector<llama_token>> prompts;
+    if (!prompt.empty()) {
+      prompts.push_back(edge_tokenize_prompt(vocab, prompt, n_ctx));
+    } else {
+      std::mt19937 rng(42);
+      std::uniform_int_distribution<int> pick(0, llama_vocab_n_tokens(vocab) - 1);
+      for (int n : n_prompt) {
+        if (n == NA_INTEGER || n < 1 || n >= n_ctx) {
+          stop("n_prompt must be between 1 and " + std::to_string(n_ctx - 1));
+        }
+        std::vector<llama_token> tokens(n);
+        for (int i = 0; i < n; ++i) tokens[i] = pick(rng);
+        if (llama_vocab_get_add_bos(vocab)) tokens[0] = llama_vocab_bos(vocab);
+        prompts.push_back(tokens);
+      }
+    }
+    size_t longest = 0;
+    for (const auto& tokens : prompts) longest = std::max(longest, tokens.size());
+    for (int n : n_gen) {
+      if (n == NA_INTEGER || n < 0) stop("n_gen must be a non-negative integer");
+      if (longest + n > (size_t)n_ctx) {
+        stop("n_prompt + n_gen (" + std::to_string(longest + n) + ") exceeds the context size (" +
+             std::to_string(n_ctx) + ")");
+      }
+    }
+    for (int n : n_batch) {
+      if (n == NA_INTEGER || n < 0 || n > max_ubatch) {
+        stop("n_batch must be between 1 and " + std::to_string(max_ubatch) +
+             ", the context's micro-batch size, or 0 for that size");
+      }
+    }
+    for (int n : n_threads) {
+      if (n == NA_INTEGER || n < 0) {
+        stop("n_threads must be a positive integer, or 0 for the context's thread counts");
+      }
+    }
+    if (repetitions < 1) stop("repetitions must be a positive integer");
+
+    // The runs fill the KV cache with benchmark tokens and may change the
+    // thread counts; both are put back however the call ends
+    struct Restore {
+      EdgeModelContext* edge_ctx;
+      ~Restore() {
+        llama_memory_clear(llama_get_memory(edge_ctx->ctx), true);
+        edge_ctx->cached_tokens.clear();
+        llama_set_n_threads(edge_ctx->ctx, edge_ctx->ctx_params.n_threads, edge_ctx->ctx_params.n_threads_batch);
+      }
+    } restore{edge_ctx.get()};
+    EdgeCallScope scope(edge_ctx.get());
+
+    // Same truncation and temperature as the default edge_completion() chain,
+    // with a fixed seed and timing enabled
+    llama_sampler_chain_params chain_params = llama_sampler_chain_default_params();
+    chain_params.no_perf = false;
+    std::unique_ptr<llama_sampler, decltype(&llama_sampler_free)> sampler(
+      llama_sampler_chain_init(chain_params), llama_sampler_free);
+    llama_sampler_chain_add(sampler.get(), llama_sampler_init_top_p(0.95f, 1));
+    llama_sampler_chain_add(sampler.get(), llama_sampler_init_temp(0.8f));
+    llama_sampler_chain_add(sampler.get(), llama_sampler_init_dist(42));
+
+    auto decode = [&](llama_token* tokens, int n) {
+      const int rc = llama_decode(ctx, llama_batch_get_one(tokens, n));
+      if (rc == 2) edge_throw_stopped(edge_ctx.get());
+      if (rc != 0) stop("Failed to decode benchmark tokens");
+      // Each step is timed on its own rather than queued behind the next
+      llama_synchronize(ctx);
+    };
+
+    // Prefill the prompt in chunks of `batch`, then generate `gen` tokens one
+    // at a time. llama_perf_context() times the decodes; a snapshot after the
+    // prompt separates the phases whatever size the chunks are.
+    auto run = [&](std::vector<llama_token>& tokens, int gen, int batch) {
+      EdgeBenchRun result;
+      llama_memory_clear(llama_get_memory(ctx), true);
+      llama_perf_context_reset(ctx);
+      llama_sampler_reset(sampler.get());
+      llama_perf_sampler_reset(sampler.get());
+
+      const int64_t t_start = ggml_time_us();
+      const int n = (int)tokens.size();
+      for (int i = 0; i < n; i += batch) {
+        decode(tokens.data() + i, std::min(batch, n - i));
+      }
+      llama_token token = llama_sampler_sample(sampler.get(), ctx, -1);
+      result.ttft_ms = (ggml_time_us() - t_start) / 1000.0;
+      const llama_perf_context_data prefill = llama_perf_context(ctx);
+      result.prompt_ms = prefill.t_p_eval_ms + prefill.t_eval_ms;
+
+      for (int i = 0; i < gen; ++i) {
+        decode(&token, 1);
+        token = llama_sampler_sample(sampler.get(), ctx, -1);
+      }
+      const llama_perf_context_data total = llama_perf_context(ctx);
+      result.decode_ms = total.t_p_eval_ms + total.t_eval_ms - result.prompt_ms;
+      result.sample_ms = llama_perf_sampler(sampler.get()).t_sample_ms;
+      return result;
+    };
+
+    std::vector<int> col_prompt, col_gen, col_batch, col_threads, col_threads_batch, col_rep;
+    std::vector<double> col_prompt_ms, col_prompt_tps, col_decode_ms, col_decode_tps, col_sample_ms, col_ttft_ms;
+
+    for (int threads : n_threads) {
+      // A pool runs at most the threads it was created with
+      int gen_threads = threads > 0 ? threads : (int)params.n_threads;
+      int batch_threads = threads > 0 ? threads : (int)params.n_threads_batch;
+      if (edge_ctx->threadpool) {
+        gen_threads = std::min(gen_threads, edge_ctx->threadpool_size);
+        batch_threads = std::min(batch_threads, edge_ctx->threadpool_batch_size);
+      }
+      llama_set_n_threads(ctx, gen_threads, batch_threads);
+
+      // Untimed warm-up: the first decodes page in the weights and start the threads
+      std::vector<llama_token> warmup(prompts[0].begin(), prompts[0].begin() + std::min<size_t>(prompts[0].size(), 8));
+      run(warmup, 1, max_batch);
+
+      for (int batch_setting : n_batch) {
+        const int batch = batch_setting > 0 ? batch_setting : max_ubatch;
+        for (auto& tokens : prompts) {
+          for (int gen : n_gen) {
+            for (int rep = 1; rep <= repetitions; ++rep) {
+              const EdgeBenchRun r = run(tokens, gen, batch);
+              col_prompt.push_back((int)tokens.size());
+              col_gen.push_back(gen);
+              col_batch.push_back(batch);
+              col_threads.push_back(gen_threads);
+              col_threads_batch.push_back(batch_threads);
+              col_rep.push_back(rep);
+              col_prompt_ms.push_back(r.prompt_ms);
+              col_prompt_tps.push_back(r.prompt_ms > 0 ? tokens.size() * 1000.0 / r.prompt_ms : NA_REAL);
+              col_decode_ms.push_back(r.decode_ms);
+              col_decode_tps.push_back(gen > 0 && r.decode_ms > 0 ? gen * 1000.0 / r.decode_ms : NA_REAL);
+              col_sample_ms.push_back(r.sample_ms);
+              col_ttft_ms.push_back(r.ttft_ms);
+            }
+          }
+        }
+      }
+    }
+
+    char desc[128];
+    llama_model_desc(edge_ctx->model, desc, sizeof(desc));
+
+    return DataFrame::create(
+      Named("model") = std::vector<std::string>(col_prompt.size(), desc),
+      Named("n_prompt") = col_prompt,
+      Named("n_gen") = col_gen,
+      Named("n_batch") = col_batch,
+      Named("n_threads") = col_threads,
+      Named("n_threads_batch") = col_threads_batch,
+      Named("repetition") = col_rep,
+      Named("prompt_ms") = col_prompt_ms,
+      Named("prompt_tokens_per_sec") = col_prompt_tps,
+      Named("decode_ms") = col_decode_ms,
+      Named("decode_tokens_per_sec") = col_decode_tps,
+      Named("sample_ms") = col_sample_ms,
+      Named("ttft_ms") = col_ttft_ms,
+      Named("stringsAsFactors") = false
+    );
+  } catch (const std::exception& e) {
+    stop("Error running benchmark: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+void edge_profile_start_internal(SEXP model_ptr, bool trace = false) {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) stop("Invalid model context");
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    if (!edge_ctx->is_valid()) stop("Invalid model context");
+    if (!edge_ctx->profiler) stop("Profiling is off for this context; load the model with profile = TRUE");
+    edge_ctx->profiler->start(trace);
+  } catch (const std::exception& e) {
+    stop("Error starting profiler: " + std::string(e.what()));
+  }
+}
+
+// Append `s` to `out` as the contents of a JSON string
+static void edge_json_escape(std::string& out, const std::string& s) {
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+}
+
+// [[Rcpp::export]]
+DataFrame edge_profile_stop_internal(SEXP model_ptr, std::string trace_path = "") {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) stop("Invalid model context");
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    if (!edge_ctx->is_valid()) stop("Invalid model context");
+    if (!edge_ctx->profiler) stop("Profiling is off for this context; load the model with profile = TRUE");
+    EdgeProfiler& profiler = *edge_ctx->profiler;
+    profiler.enabled = false;
+
+    // Chrome trace event format, one complete ("X") event per node, in
+    // microseconds since profiling started
+    if (!trace_path.empty()) {
+      std::ofstream file(trace_path, std::ios::binary);
+      if (!file) stop("Cannot open trace file: " + trace_path);
+      std::string json = "{\"traceEvents\":[\n";
+      char buf[160];
+      for (size_t i = 0; i < profiler.events.size(); ++i) {
+        const EdgeProfiler::Event& ev = profiler.events[i];
+        snprintf(buf, sizeof(buf), "{\"name\":\"%s\",\"cat\":\"ggml\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                 "\"pid\":1,\"tid\":1,\"args\":{\"layer\":%d,\"tensor\":\"",
+                 ev.op, ev.start_ns / 1000.0, ev.dur_ns / 1000.0, ev.layer);
+        json += buf;
+        edge_json_escape(json, ev.tensor);
+        json += i + 1 < profiler.events.size() ? "\"}},\n" : "\"}}\n";
+      }
+      json += "],\"displayTimeUnit\":\"ms\"}\n";
+      file.write(json.data(), (std::streamsize)json.size());
+      if (!file) stop("Failed to write trace file: " + trace_path);
+    }
+
+    const int n = (int)profiler.stats.size();
+    CharacterVector op(n);
+    IntegerVector layer(n), calls(n);
+    NumericVector time_ms(n), flops(n), bytes(n);
+    int i = 0;
+    for (const auto& entry : profiler.stats) {
+      op[i] = entry.first.first;
+      layer[i] = entry.first.second < 0 ? NA_INTEGER : entry.first.second;
+      calls[i] = (int)entry.second.calls;
+      time_ms[i] = entry.second.time_ns / 1e6;
+      flops[i] = entry.second.flops;
+      bytes[i] = entry.second.bytes;
+      ++i;
+    }
+    profiler.stats.clear();
+    profiler.events.clear();
+    profiler.events.shrink_to_fit();
+
+    return DataFrame::create(
+      Named("op") = op,
+      Named("layer") = layer,
+      Named("calls") = calls,
+      Named("time_ms") = time_ms,
+      Named("flops") = flops,
+      Named("bytes") = bytes,
+      Named("stringsAsFactors") = false
+    );
+  } catch (const std::exception& e) {
+    stop("Error stopping profiler: " + std::string(e.what()));
+  }
+}
+
+// Session snapshots of sequence 0 use the layout of llama_state_seq_save_file():
+// magic, version and token count as uint32, the cached tokens, then the
+// sequence state. A snapshot kept in memory and written to disk is a valid
+// state file, and the other way round.
+static const size_t EDGE_STATE_HEADER = 3 * sizeof(uint32_t);
+
+static size_t edge_state_size(EdgeModelContext* edge_ctx) {
+  return EDGE_STATE_HEADER + edge_ctx->cached_tokens.size() * sizeof(llama_token) +
+         llama_state_seq_get_size(edge_ctx->ctx, 0);
+}
+
+// Write the snapshot into `dst`, which holds edge_state_size() bytes
+static void edge_state_write(EdgeModelContext* edge_ctx, uint8_t* dst, size_t size) {
+  const std::vector<llama_token>& tokens = edge_ctx->cached_tokens;
+  const uint32_t header[3] = {LLAMA_STATE_SEQ_MAGIC, LLAMA_STATE_SEQ_VERSION, (uint32_t)tokens.size()};
+  std::memcpy(dst, header, EDGE_STATE_HEADER);
+  std::memcpy(dst + EDGE_STATE_HEADER, tokens.data(), tokens.size() * sizeof(llama_token));
+  const size_t offset = EDGE_STATE_HEADER + tokens.size() * sizeof(llama_token);
+  if (llama_state_seq_get_data(edge_ctx->ctx, dst + offset, size - offset, 0) != size - offset) {
+    stop("Failed to copy the context state");
+  }
+}
+
+// Restore sequence 0 from a snapshot in memory. Returns the number of tokens
+// restored; on failure the cache is left empty.
+static size_t edge_state_read(EdgeModelContext* edge_ctx, const uint8_t* src, size_t size) {
+  uint32_t header[3] = {0, 0, 0};
+  if (size >= EDGE_STATE_HEADER) {
+    std::memcpy(header, src, EDGE_STATE_HEADER);
+  }
+  if (size < EDGE_STATE_HEADER || header[0] != LLAMA_STATE_SEQ_MAGIC || header[1] != LLAMA_STATE_SEQ_VERSION) {
+    stop("Not a session state snapshot");
+  }
+  const size_t n_tokens = header[2];
+  if (n_tokens > llama_n_ctx(edge_ctx->ctx)) {
+    stop("The snapshot holds " + std::to_string(n_tokens) + " tokens, more than the context size (" +
+         std::to_string(llama_n_ctx(edge_ctx->ctx)) + ")");
+  }
+  const size_t offset = EDGE_STATE_HEADER + n_tokens * sizeof(llama_token);
+  if (size < offset) {
+    stop("The snapshot is truncated");
+  }
+
+  std::vector<llama_token> tokens(n_tokens);
+  std::memcpy(tokens.data(), src + EDGE_STATE_HEADER, n_tokens * sizeof(llama_token));
+  if (llama_state_seq_set_data(edge_ctx->ctx, src + offset, size - offset, 0) == 0) {
+    llama_memory_clear(llama_get_memory(edge_ctx->ctx), true);
+    stop("The snapshot does not match this model and context");
+  }
+  edge_ctx->cached_tokens.swap(tokens);
+  return n_tokens;
+}
+
+// Clear sequence 0 before a snapshot is restored into it
+static void edge_state_reset(EdgeModelContext* edge_ctx) {
+  llama_memory_t mem = llama_get_memory(edge_ctx->ctx);
+  if (mem) {
+    llama_memory_clear(mem, true);
+  }
+  edge_ctx->cached_tokens.clear();
+}
+
+// [[Rcpp::export]]
+SEXP edge_state_save_internal(SEXP model_ptr, std::string path = "", std::string prompt = "") {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) stop("Invalid model context");
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    if (!edge_ctx->is_valid()) stop("Invalid model context");
+
+    // Prefill the prompt first, reusing whatever prefix is already cached.
+    // A prefill that was stopped is not saved: it would not match the prompt.
+    if (!prompt.empty()) {
+      const llama_vocab* vocab = llama_model_get_vocab(edge_ctx->model);
+      EdgeCallScope scope(edge_ctx.get());
+      edge_decode_prompt(edge_ctx.get(), edge_tokenize_prompt(vocab, prompt, llama_n_ctx(edge_ctx->ctx)));
+      if (edge_ctx->stop_reason != EDGE_STOP_NONE) {
+        edge_throw_stopped(edge_ctx.get());
+      }
+    }
+
+    const std::vector<llama_token>& tokens = edge_ctx->cached_tokens;
+    if (!path.empty()) {
+      const size_t n_bytes = llama_state_seq_save_file(edge_ctx->ctx, path.c_str(), 0, tokens.data(), tokens.size());
+      if (n_bytes == 0) {
+        stop("Failed to write session state to " + path);
+      }
+      return wrap((double)n_bytes);
+    }
+
+    const size_t size = edge_state_size(edge_ctx.get());
+    RawVector out((R_xlen_t)size);
+    edge_state_write(edge_ctx.get(), RAW(out), size);
+    return out;
+  } catch (const std::exception& e) {
+    stop("Error saving session state: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+int edge_state_load_internal(SEXP model_ptr, SEXP state) {
+  try {
+    if (TYPEOF(model_ptr) != EXTPTRSXP) stop("Invalid model context");
+    XPtr<EdgeModelContext> edge_ctx(model_ptr);
+    if (!edge_ctx->is_valid()) stop("Invalid model context");
+
+    edge_state_reset(edge_ctx.get());
+    if (TYPEOF(state) == RAWSXP) {
+      return (int)edge_state_read(edge_ctx.get(), RAW(state), (size_t)Rf_xlength(state));
+    }
+
+    const std::string path = as<std::string>(state);
+    std::vector<llama_token> tokens(llama_n_ctx(edge_ctx->ctx));
+    size_t n_tokens = 0;
+    if (llama_state_seq_load_file(edge_ctx->ctx, path.c_str(), 0, tokens.data(), tokens.size(), &n_tokens) == 0) {
+      edge_state_reset(edge_ctx.get());
+      stop("Failed to restore session state from " + path +
+           "; it is not a snapshot of this model, or holds more tokens than the context size");
+    }
+    tokens.resize(n_tokens);
+    edge_ctx->cached_tokens.swap(tokens);
+    return (int)n_tokens;
+  } catch (const std::exception& e) {
+    stop("Error loading session state: " + std::string(e.what()));
+  }
+}
+
 // [[Rcpp::export]]
 int edge_model_n_embd_internal(SEXP model_ptr) {
   try {
@@ -0,0 +1,209 @@
+// Runtime selection of the x86 quantized kernels (see cpu_dispatch.h).
+//
+// This file MUST be compiled with GGML_CXXFLAGS so that it sees the same
+// EDGEMODELR_CPU_DISPATCH / GGML_CPU_GENERIC configuration as the engine.
+
+#include "cpu_dispatch.h"
+
+#ifdef EDGEMODELR_CPU_DISPATCH
+
+#include <cstdlib>
+#include <cstring>
+
+#include "ggml-cpu.h"
+#include "quants.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// Kernels and feature scores provided by each variant object
+#define EDGE_DECLARE_VEC_DOT(fn, v) \
+  void EDGE_CPU_VARIANT_SYMBOL_(fn, v)(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, size_t bx, const void * GGML_RESTRICT vy, size_t by, int nrc);
+#define EDGE_DECLARE_QUANTIZE(fn, v) \
+  void EDGE_CPU_VARIANT_SYMBOL_(fn, v)(const float * GGML_RESTRICT x, void * GGML_RESTRICT y, int64_t k);
+#define EDGE_DECLARE_VARIANT(v)                         \
+  EDGE_CPU_VEC_DOT_KERNELS(EDGE_DECLARE_VEC_DOT, v)     \
+  EDGE_CPU_QUANTIZE_KERNELS(EDGE_DECLARE_QUANTIZE, v)   \
+  int EDGE_CPU_VARIANT_SYMBOL_(ggml_backend_score, v)(void);
+
+extern "C" {
+EDGE_CPU_VARIANTS(EDGE_DECLARE_VARIANT)
+}
+
+namespace {
+
+struct cpu_kernel_table {
+  const char * name;
+  int (*score)(void);
+#define EDGE_VEC_DOT_MEMBER(fn, v) ggml_vec_dot_t fn;
+#define EDGE_QUANTIZE_MEMBER(fn, v) ggml_from_float_t fn;
+  EDGE_CPU_VEC_DOT_KERNELS(EDGE_VEC_DOT_MEMBER, _)
+  EDGE_CPU_QUANTIZE_KERNELS(EDGE_QUANTIZE_MEMBER, _)
+#undef EDGE_VEC_DOT_MEMBER
+#undef EDGE_QUANTIZE_MEMBER
+};
+
+#define EDGE_KERNEL_ENTRY(fn, v) EDGE_CPU_VARIANT_SYMBOL_(fn, v),
+#define EDGE_VARIANT_ENTRY(v)                         \
+  { #v, EDGE_CPU_VARIANT_SYMBOL_(ggml_backend_score, v), \
+    EDGE_CPU_VEC_DOT_KERNELS(EDGE_KERNEL_ENTRY, v)    \
+    EDGE_CPU_QUANTIZE_KERNELS(EDGE_KERNEL_ENTRY, v) },
+
+// Ordered from least to most capable; index 0 runs on any x86_64 CPU.
+const cpu_kernel_table g_variants[] = {
+  EDGE_CPU_VARIANTS(EDGE_VARIANT_ENTRY)
+};
+
+#undef EDGE_KERNEL_ENTRY
+#undef EDGE_VARIANT_ENTRY
+
+const int g_n_variants = (int)(sizeof(g_variants) / sizeof(g_variants[0]));
+
+void cpuid_count(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+  int r[4];
+  __cpuidex(r, (int)leaf, (int)subleaf);
+  for (int i = 0; i < 4; ++i) regs[i] = (unsigned int)r[i];
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// XCR0 state components the OS saves on context switch. The feature scores
+// from cpu-feats.cpp only look at CPUID, which does not guarantee that the
+// OS has enabled the wider register files.
+unsigned long long os_enabled_xstate() {
+  unsigned int regs[4];
+  cpuid_count(1, 0, regs);
+  const bool osxsave = (regs[2] >> 27) & 1;
+  if (!osxsave) {
+    return 0;
+  }
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  unsigned int eax, edx;
+  __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+int variant_score(int i) {
+  const unsigned long long xcr0 = os_enabled_xstate();
+  const bool os_avx = (xcr0 & 0x6) == 0x6;        // XMM | YMM
+  const bool os_avx512 = (xcr0 & 0xE6) == 0xE6;   // + opmask, ZMM_Hi256, Hi16_ZMM
+
+  const char * name = g_variants[i].name;
+  if (std::strcmp(name, "avx2") == 0 && !os_avx) return 0;
+  if (std::strcmp(name, "avx512") == 0 && !os_avx512) return 0;
+  return g_variants[i].score();
+}
+
+const cpu_kernel_table * select_variant() {
+  // EDGEMODELR_CPU_VARIANT forces a specific (supported) variant, which is
+  // useful for benchmarking the kernels against each other.
+  const char * forced = std::getenv("EDGEMODELR_CPU_VARIANT");
+  if (forced && *forced) {
+    for (int i = 0; i < g_n_variants; ++i) {
+      if (std::strcmp(forced, g_variants[i].name) == 0 && variant_score(i) > 0) {
+        return &g_variants[i];
+      }
+    }
+  }
+
+  // Same rule as ggml_backend_load_best(): highest non-zero score wins
+  const cpu_kernel_table * best = &g_variants[0];
+  int best_score = 0;
+  for (int i = 0; i < g_n_variants; ++i) {
+    int s = variant_score(i);
+    if (s > best_score) {
+      best_score = s;
+      best = &g_variants[i];
+    }
+  }
+  return best;
+}
+
+// Chosen once when the shared library is loaded, before any graph runs.
+const cpu_kernel_table * const g_active = select_variant();
+
+} // namespace
+
+// Plain-named kernels referenced by the ggml-cpu type traits
+#define EDGE_DEFINE_VEC_DOT(fn, v)                                                        \
+  void fn(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx,       \
+          size_t bx, const void * GGML_RESTRICT vy, size_t by, int nrc) {                 \
+    g_active->fn(n, s, bs, vx, bx, vy, by, nrc);                                          \
+  }
+#define EDGE_DEFINE_QUANTIZE(fn, v)                                                       \
+  void fn(const float * GGML_RESTRICT x, void * GGML_RESTRICT y, int64_t k) {             \
+    g_active->fn(x, y, k);                                                                \
+  }
+
+extern "C" {
+EDGE_CPU_VEC_DOT_KERNELS(EDGE_DEFINE_VEC_DOT, _)
+EDGE_CPU_QUANTIZE_KERNELS(EDGE_DEFINE_QUANTIZE, _)
+}
+
+const char * edge_cpu_dispatch_variant(void) {
+  return g_active->name;
+}
+
+int edge_cpu_dispatch_enabled(void) {
+  return 1;
+}
+
+int edge_cpu_dispatch_n_variants(void) {
+  return g_n_variants;
+}
+
+const char * edge_cpu_dispatch_variant_name(int i) {
+  return (i >= 0 && i < g_n_variants) ? g_variants[i].name : "";
+}
+
+int edge_cpu_dispatch_variant_supported(int i) {
+  return (i >= 0 && i < g_n_variants) ? variant_score(i) > 0 : 0;
+}
+
+#else // !EDGEMODELR_CPU_DISPATCH
+
+const char * edge_cpu_dispatch_variant(void) {
+#if defined(GGML_CPU_GENERIC)
+  return "generic";
+#elif defined(__AVX512F__)
+  return "avx512";
+#elif defined(__AVX2__)
+  return "avx2";
+#elif defined(__AVX__)
+  return "avx";
+#elif defined(__SSE4_2__)
+  return "sse42";
+#elif defined(__x86_64__) || defined(_M_X64)
+  return "x64";
+#elif defined(__ARM_NEON)
+  return "neon";
+#else
+  return "generic";
+#endif
+}
+
+int edge_cpu_dispatch_enabled(void) {
+  return 0;
+}
+
+int edge_cpu_dispatch_n_variants(void) {
+  return 1;
+}
+
+const char * edge_cpu_dispatch_variant_name(int i) {
+  return i == 0 ? edge_cpu_dispatch_variant() : "";
+}
+
+int edge_cpu_dispatch_variant_supported(int i) {
+  return i == 0;
+}
+
+#endif // EDGEMODELR_CPU_DISPATCH
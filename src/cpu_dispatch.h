@@ -0,0 +1,116 @@
+#ifndef EDGEMODELR_CPU_DISPATCH_H
+#define EDGEMODELR_CPU_DISPATCH_H
+
+// Runtime CPU feature dispatch for the quantized ggml-cpu kernels.
+//
+// When built with EDGEMODELR_CPU_DISPATCH (the default on x86_64), the x86
+// kernels in ggml/ggml-cpu/arch/x86/quants.c are compiled once per variant
+// (x64, sse42, avx2, avx512). This header is included first into each of
+// those compilation units (by cpu_dispatch_kernels.c, which also enables
+// the variant's instruction set with target pragmas) with
+// EDGEMODELR_CPU_VARIANT set to the variant name, which suffixes every
+// exported kernel (e.g. ggml_vec_dot_q4_0_q8_0 becomes
+// ggml_vec_dot_q4_0_q8_0_avx2). cpu_dispatch.cpp then provides the
+// plain-named kernels that ggml-cpu.c references and forwards them to the
+// best variant supported by the host CPU, chosen once at load time.
+
+// Kernel lists shared by the variant renames and the dispatcher.
+#define EDGE_CPU_VEC_DOT_KERNELS(X, v)   \
+  X(ggml_vec_dot_q4_0_q8_0, v)           \
+  X(ggml_vec_dot_q4_1_q8_1, v)           \
+  X(ggml_vec_dot_q5_0_q8_0, v)           \
+  X(ggml_vec_dot_q5_1_q8_1, v)           \
+  X(ggml_vec_dot_q8_0_q8_0, v)           \
+  X(ggml_vec_dot_mxfp4_q8_0, v)          \
+  X(ggml_vec_dot_tq1_0_q8_K, v)          \
+  X(ggml_vec_dot_tq2_0_q8_K, v)          \
+  X(ggml_vec_dot_q2_K_q8_K, v)           \
+  X(ggml_vec_dot_q3_K_q8_K, v)           \
+  X(ggml_vec_dot_q4_K_q8_K, v)           \
+  X(ggml_vec_dot_q5_K_q8_K, v)           \
+  X(ggml_vec_dot_q6_K_q8_K, v)           \
+  X(ggml_vec_dot_iq2_xxs_q8_K, v)        \
+  X(ggml_vec_dot_iq2_xs_q8_K, v)         \
+  X(ggml_vec_dot_iq2_s_q8_K, v)          \
+  X(ggml_vec_dot_iq3_xxs_q8_K, v)        \
+  X(ggml_vec_dot_iq3_s_q8_K, v)          \
+  X(ggml_vec_dot_iq1_s_q8_K, v)          \
+  X(ggml_vec_dot_iq1_m_q8_K, v)          \
+  X(ggml_vec_dot_iq4_nl_q8_0, v)         \
+  X(ggml_vec_dot_iq4_xs_q8_K, v)
+
+#define EDGE_CPU_QUANTIZE_KERNELS(X, v)  \
+  X(quantize_row_q8_0, v)                \
+  X(quantize_row_q8_1, v)                \
+  X(quantize_row_q8_K, v)
+
+#define EDGE_CPU_VARIANTS(X)             \
+  X(x64)                                 \
+  X(sse42)                               \
+  X(avx2)                                \
+  X(avx512)
+
+#define EDGE_CPU_VARIANT_SYMBOL__(name, v) name##_##v
+#define EDGE_CPU_VARIANT_SYMBOL_(name, v) EDGE_CPU_VARIANT_SYMBOL__(name, v)
+
+#ifdef EDGEMODELR_CPU_VARIANT
+// Per-variant symbol renames (the preprocessor cannot generate #defines, so
+// this list mirrors EDGE_CPU_VEC_DOT_KERNELS / EDGE_CPU_QUANTIZE_KERNELS).
+#define EDGE_CPU_VARIANT_SYMBOL(name) EDGE_CPU_VARIANT_SYMBOL_(name, EDGEMODELR_CPU_VARIANT)
+
+#define ggml_vec_dot_q4_0_q8_0    EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_q4_0_q8_0)
+#define ggml_vec_dot_q4_1_q8_1    EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_q4_1_q8_1)
+#define ggml_vec_dot_q5_0_q8_0    EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_q5_0_q8_0)
+#define ggml_vec_dot_q5_1_q8_1    EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_q5_1_q8_1)
+#define ggml_vec_dot_q8_0_q8_0    EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_q8_0_q8_0)
+#define ggml_vec_dot_mxfp4_q8_0   EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_mxfp4_q8_0)
+#define ggml_vec_dot_tq1_0_q8_K   EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_tq1_0_q8_K)
+#define ggml_vec_dot_tq2_0_q8_K   EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_tq2_0_q8_K)
+#define ggml_vec_dot_q2_K_q8_K    EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_q2_K_q8_K)
+#define ggml_vec_dot_q3_K_q8_K    EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_q3_K_q8_K)
+#define ggml_vec_dot_q4_K_q8_K    EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_q4_K_q8_K)
+#define ggml_vec_dot_q5_K_q8_K    EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_q5_K_q8_K)
+#define ggml_vec_dot_q6_K_q8_K    EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_q6_K_q8_K)
+#define ggml_vec_dot_iq2_xxs_q8_K EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_iq2_xxs_q8_K)
+#define ggml_vec_dot_iq2_xs_q8_K  EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_iq2_xs_q8_K)
+#define ggml_vec_dot_iq2_s_q8_K   EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_iq2_s_q8_K)
+#define ggml_vec_dot_iq3_xxs_q8_K EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_iq3_xxs_q8_K)
+#define ggml_vec_dot_iq3_s_q8_K   EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_iq3_s_q8_K)
+#define ggml_vec_dot_iq1_s_q8_K   EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_iq1_s_q8_K)
+#define ggml_vec_dot_iq1_m_q8_K   EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_iq1_m_q8_K)
+#define ggml_vec_dot_iq4_nl_q8_0  EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_iq4_nl_q8_0)
+#define ggml_vec_dot_iq4_xs_q8_K  EDGE_CPU_VARIANT_SYMBOL(ggml_vec_dot_iq4_xs_q8_K)
+
+#define quantize_row_q8_0         EDGE_CPU_VARIANT_SYMBOL(quantize_row_q8_0)
+#define quantize_row_q8_1         EDGE_CPU_VARIANT_SYMBOL(quantize_row_q8_1)
+#define quantize_row_q8_K         EDGE_CPU_VARIANT_SYMBOL(quantize_row_q8_K)
+
+// cpu-feats.cpp exports its feature score as ggml_backend_score when built
+// with GGML_BACKEND_DL; give each variant its own copy.
+#define ggml_backend_score        EDGE_CPU_VARIANT_SYMBOL(ggml_backend_score)
+
+#else // !EDGEMODELR_CPU_VARIANT
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Name of the kernel variant in use ("avx2", "x64", ...). Builds without
+// runtime dispatch report the level fixed at compile time.
+const char * edge_cpu_dispatch_variant(void);
+
+// 1 if the package was built with runtime CPU dispatch, 0 otherwise.
+int edge_cpu_dispatch_enabled(void);
+
+// Number of compiled variants and their names / host support, for reporting.
+int edge_cpu_dispatch_n_variants(void);
+const char * edge_cpu_dispatch_variant_name(int i);
+int edge_cpu_dispatch_variant_supported(int i);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EDGEMODELR_CPU_VARIANT
+
+#endif // EDGEMODELR_CPU_DISPATCH_H
@@ -0,0 +1,91 @@
+// Per-variant build of the x86 quantized kernels (see cpu_dispatch.h).
+//
+// Compiled once per variant with EDGEMODELR_CPU_VARIANT and the matching
+// GGML_* feature defines. The instruction set is enabled here with target
+// pragmas rather than -m flags, so the default install passes only portable
+// flags to the compiler and only these kernels may use the wider ISA.
+
+#include "cpu_dispatch.h"
+
+// Headers whose declarations must not pick up the target attribute below
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+// clang applies the target to every function below but, unlike GCC, does
+// not define the feature macros the kernels test for.
+#if defined(__clang__)
+#  if defined(GGML_AVX512)
+#    pragma clang attribute push(__attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,avx2,fma,f16c"))), apply_to = function)
+#  elif defined(GGML_AVX2)
+#    pragma clang attribute push(__attribute__((target("avx2,fma,f16c"))), apply_to = function)
+#  elif defined(GGML_SSE42)
+#    pragma clang attribute push(__attribute__((target("sse4.2"))), apply_to = function)
+#  endif
+#  if defined(GGML_SSE42)
+#    ifndef __SSE3__
+#      define __SSE3__ 1
+#    endif
+#    ifndef __SSSE3__
+#      define __SSSE3__ 1
+#    endif
+#    ifndef __SSE4_1__
+#      define __SSE4_1__ 1
+#    endif
+#    ifndef __SSE4_2__
+#      define __SSE4_2__ 1
+#    endif
+#  endif
+#  if defined(GGML_AVX2)
+#    ifndef __AVX__
+#      define __AVX__ 1
+#    endif
+#    ifndef __AVX2__
+#      define __AVX2__ 1
+#    endif
+#    ifndef __FMA__
+#      define __FMA__ 1
+#    endif
+#    ifndef __F16C__
+#      define __F16C__ 1
+#    endif
+#  endif
+#  if defined(GGML_AVX512)
+#    ifndef __AVX512F__
+#      define __AVX512F__ 1
+#    endif
+#    ifndef __AVX512BW__
+#      define __AVX512BW__ 1
+#    endif
+#    ifndef __AVX512DQ__
+#      define __AVX512DQ__ 1
+#    endif
+#    ifndef __AVX512VL__
+#      define __AVX512VL__ 1
+#    endif
+#  endif
+#else
+// GCC also defines __AVX2__ etc. for the rest of the file
+#  pragma GCC push_options
+#  if defined(GGML_AVX512)
+#    pragma GCC target("avx512f,avx512bw,avx512dq,avx512vl,avx2,fma,f16c")
+#  elif defined(GGML_AVX2)
+#    pragma GCC target("avx2,fma,f16c")
+#  elif defined(GGML_SSE42)
+#    pragma GCC target("sse4.2")
+#  endif
+#endif
+
+#include "ggml/ggml-cpu/arch/x86/quants.c"
+
+#if defined(__clang__)
+#  if defined(GGML_SSE42)
+#    pragma clang attribute pop
+#  endif
+#else
+#  pragma GCC pop_options
+#endif
@@ -0,0 +1,23 @@
+// KV cache size reported by edge_context_stats().
+//
+// llama.h has no call for the memory a context allocated for its KV cache
+// (or recurrent state): llama_state_seq_get_size() only counts the cells in
+// use, and the per-layer sizes depend on sliding-window layers and head
+// sizes the public model parameters do not describe. This file is the only
+// one that reads llama.cpp's internal memory interface, so recheck
+// llama_memory_i::memory_breakdown() here whenever llama.cpp is re-vendored.
+
+#include "llama.h"
+#include "llama-memory.h"
+
+// Bytes allocated for the KV cache (or recurrent state) of a context
+double edge_kv_cache_bytes(const llama_context* ctx) {
+  llama_memory_t mem = llama_get_memory(ctx);
+  double total = 0;
+  if (mem) {
+    for (const auto& buft_size : mem->memory_breakdown()) {
+      total += (double)buft_size.second;
+    }
+  }
+  return total;
+}
@@ -9,6 +9,8 @@
 #include <cstdint>
 #include <stdexcept>
 #include <cstdio>
+#include <deque>
+#include <functional>
 
 /* CRAN compliance: suppress fprintf/stderr diagnostic output in R builds.
  * These only run via llama_grammar_print (a debug helper) which is not
@@ -24,6 +26,7 @@
 #endif
 
 #define MAX_REPETITION_THRESHOLD 2000
+#define LLAMA_GRAMMAR_MAX_TRIE_MASKS 64
 //
 // helpers
 //
@@ -1091,6 +1094,285 @@ llama_grammar_candidates llama_grammar_reject_candidates_for_stack(
 
 ////////////////////
 
+std::unique_ptr<llama_grammar_trie> llama_grammar_trie_build(const llama_vocab & vocab) {
+    auto trie = std::make_unique<llama_grammar_trie>();
+
+    const uint32_t n_vocab = vocab.n_tokens();
+
+    std::vector<std::pair<std::vector<uint32_t>, llama_partial_utf8>> decoded;
+    std::vector<llama_token> ids;
+    decoded.reserve(n_vocab);
+    ids.reserve(n_vocab);
+
+    for (uint32_t i = 0; i < n_vocab; ++i) {
+        const llama_token id = (llama_token) i;
+        if (vocab.is_eog(id)) {
+            trie->eog.push_back(id);
+            continue;
+        }
+        const std::string & piece = vocab.token_to_piece(id);
+        if (piece.empty() || piece[0] == 0) {
+            continue;
+        }
+        auto dec = decode_utf8(piece, { 0, 0 });
+        if (dec.second.n_remain < 0) {
+            continue;
+        }
+        dec.first.pop_back(); // terminating 0
+        decoded.push_back(std::move(dec));
+        ids.push_back(id);
+    }
+
+    // lexicographic order puts every token right after its prefixes, so the
+    // tokens below any node form one contiguous range
+    std::vector<uint32_t> order(ids.size());
+    for (uint32_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        if (decoded[a].first != decoded[b].first) {
+            return decoded[a].first < decoded[b].first;
+        }
+        return ids[a] < ids[b];
+    });
+
+    trie->tokens.reserve(order.size());
+    trie->partial.reserve(order.size());
+    for (const uint32_t i : order) {
+        trie->tokens.push_back(ids[i]);
+        trie->partial.push_back(decoded[i].second);
+    }
+
+    const auto code_points = [&](uint32_t t) -> const std::vector<uint32_t> & {
+        return decoded[order[t]].first;
+    };
+
+    // nodes[idx] covers tokens [begin, end), which all share a prefix of depth code points
+    const std::function<void(uint32_t, uint32_t, uint32_t, size_t)> build =
+            [&](uint32_t idx, uint32_t begin, uint32_t end, size_t depth) {
+        uint32_t own_end = begin;
+        while (own_end < end && code_points(own_end).size() == depth) {
+            ++own_end;
+        }
+
+        std::vector<std::pair<uint32_t, uint32_t>> groups;
+        for (uint32_t t = own_end; t < end; ) {
+            const uint32_t cp = code_points(t)[depth];
+            uint32_t next = t + 1;
+            while (next < end && code_points(next)[depth] == cp) {
+                ++next;
+            }
+            groups.emplace_back(t, next);
+            t = next;
+        }
+
+        const uint32_t child_begin = (uint32_t) trie->nodes.size();
+        for (const auto & g : groups) {
+            trie->nodes.push_back({ code_points(g.first)[depth], 0, 0, g.first, g.first, g.second });
+        }
+
+        auto & node = trie->nodes[idx];
+        node.child_begin = child_begin;
+        node.child_end   = child_begin + (uint32_t) groups.size();
+        node.tok_begin   = begin;
+        node.tok_own_end = own_end;
+        node.tok_end     = end;
+
+        for (size_t i = 0; i < groups.size(); ++i) {
+            build(child_begin + (uint32_t) i, groups[i].first, groups[i].second, depth + 1);
+        }
+    };
+
+    trie->nodes.push_back({ 0, 0, 0, 0, 0, 0 });
+    build(0, 0, (uint32_t) trie->tokens.size(), 0);
+
+    return trie;
+}
+
+// marks the tokens accepted by any of the grammar stacks by walking the vocab
+// trie once: a code point no stack matches prunes the whole subtree below it.
+// the stacks reached after a code point only depend on which stacks matched it,
+// so they are interned as states and each transition is computed once per call
+struct llama_grammar_trie_walk {
+    // sets of more stacks than this fall back to llama_grammar_reject_candidates
+    static constexpr size_t MAX_STACKS = 64;
+
+    struct state {
+        llama_grammar_stacks stacks;
+        std::vector<int>     next;   // per stack; -1 if not computed yet, -2 if none
+        std::vector<std::pair<uint64_t, int>> unions; // matched stacks -> state
+        bool                 has_chr = false;
+        bool                 has_tok = false;
+    };
+
+    const llama_grammar_rules & rules;
+    const llama_grammar_trie  & trie;
+    std::vector<uint64_t>     & accepted; // one bit per token
+
+    std::deque<state>                    states;
+    std::map<llama_grammar_stacks, int>  ids;
+    bool                                 overflow = false;
+
+    llama_grammar_trie_walk(const llama_grammar_rules & rules, const llama_grammar_trie & trie, std::vector<uint64_t> & accepted)
+        : rules(rules), trie(trie), accepted(accepted) {}
+
+    void accept(llama_token id) {
+        accepted[id >> 6] |= uint64_t(1) << (id & 63);
+    }
+
+    int intern(llama_grammar_stacks && stacks) {
+        if (stacks.empty()) {
+            return -2;
+        }
+        if (stacks.size() > MAX_STACKS) {
+            overflow = true;
+            return -2;
+        }
+        auto it = ids.find(stacks);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        const int id = (int) states.size();
+        states.emplace_back();
+        auto & st = states.back();
+        st.next.assign(stacks.size(), -1);
+        for (const auto & stack : stacks) {
+            if (stack.empty()) {
+                continue;
+            }
+            const auto type = stack.back()->type;
+            if (type == LLAMA_GRETYPE_TOKEN || type == LLAMA_GRETYPE_TOKEN_NOT) {
+                st.has_tok = true;
+            } else {
+                st.has_chr = true;
+            }
+        }
+        st.stacks = stacks;
+        ids.emplace(std::move(stacks), id);
+        return id;
+    }
+
+    // state after a code point matched by the char range on top of stack i
+    int advance(int sid, size_t i) {
+        if (states[sid].next[i] != -1) {
+            return states[sid].next[i];
+        }
+        const auto & stack = states[sid].stacks[i];
+        const auto * pos_after = llama_grammar_match_char(stack.back(), 0).second;
+
+        llama_grammar_stack stack_after(stack.begin(), stack.end() - 1);
+        if (!llama_grammar_is_end_of_sequence(pos_after)) {
+            stack_after.push_back(pos_after);
+        }
+        llama_grammar_stacks next_stacks;
+        llama_grammar_advance_stack(rules, stack_after, next_stacks);
+
+        const int nid = intern(std::move(next_stacks));
+        states[sid].next[i] = nid;
+        return nid;
+    }
+
+    // state after a code point matched by the stacks in mask (more than one)
+    int advance_union(int sid, uint64_t mask) {
+        for (const auto & u : states[sid].unions) {
+            if (u.first == mask) {
+                return u.second;
+            }
+        }
+        llama_grammar_stacks next_stacks;
+        for (size_t i = 0; i < states[sid].stacks.size(); ++i) {
+            if (!(mask & (uint64_t(1) << i))) {
+                continue;
+            }
+            const int nid = advance(sid, i);
+            if (nid < 0) {
+                continue;
+            }
+            for (const auto & stack : states[nid].stacks) {
+                if (std::find(next_stacks.begin(), next_stacks.end(), stack) == next_stacks.end()) {
+                    next_stacks.push_back(stack);
+                }
+            }
+        }
+        const int nid = intern(std::move(next_stacks));
+        states[sid].unions.emplace_back(mask, nid);
+        return nid;
+    }
+
+    void walk(uint32_t node_idx, int sid) {
+        const auto & node = trie.nodes[node_idx];
+
+        // tokens ending here: complete ones are accepted by any stack, a trailing
+        // partial code point needs a char range it could still complete to
+        for (uint32_t t = node.tok_begin; t < node.tok_own_end; ++t) {
+            const auto & partial = trie.partial[t];
+            if (partial.n_remain == 0) {
+                accept(trie.tokens[t]);
+                continue;
+            }
+            for (const auto & stack : states[sid].stacks) {
+                if (!stack.empty() && stack.back()->type != LLAMA_GRETYPE_TOKEN && stack.back()->type != LLAMA_GRETYPE_TOKEN_NOT &&
+                        llama_grammar_match_partial_char(stack.back(), partial)) {
+                    accept(trie.tokens[t]);
+                    break;
+                }
+            }
+        }
+
+        // a token rule on top of the stack only looks at the token id
+        if (states[sid].has_tok) {
+            for (const auto & stack : states[sid].stacks) {
+                if (stack.empty() || (stack.back()->type != LLAMA_GRETYPE_TOKEN && stack.back()->type != LLAMA_GRETYPE_TOKEN_NOT)) {
+                    continue;
+                }
+                for (uint32_t t = node.tok_own_end; t < node.tok_end; ++t) {
+                    if (llama_grammar_match_token(stack.back(), trie.tokens[t])) {
+                        accept(trie.tokens[t]);
+                    }
+                }
+            }
+        }
+
+        if (!states[sid].has_chr) {
+            return;
+        }
+
+        for (uint32_t c = node.child_begin; c < node.child_end; ++c) {
+            const uint32_t cp = trie.nodes[c].code_point;
+
+            uint64_t mask  = 0;
+            size_t   first = 0;
+            int      n     = 0;
+            const auto & stacks = states[sid].stacks;
+            for (size_t i = 0; i < stacks.size(); ++i) {
+                const auto & stack = stacks[i];
+                if (stack.empty() || stack.back()->type == LLAMA_GRETYPE_TOKEN || stack.back()->type == LLAMA_GRETYPE_TOKEN_NOT) {
+                    continue;
+                }
+                if (llama_grammar_match_char(stack.back(), cp).first) {
+                    if (n++ == 0) {
+                        first = i;
+                    }
+                    mask |= uint64_t(1) << i;
+                }
+            }
+            if (n == 0) {
+                continue;
+            }
+
+            const int nid = n == 1 ? advance(sid, first) : advance_union(sid, mask);
+            if (overflow) {
+                return;
+            }
+            if (nid >= 0) {
+                walk(c, nid);
+            }
+        }
+    }
+};
+
+////////////////////
+
 struct llama_grammar * llama_grammar_init_impl(
         const struct llama_vocab * vocab,
         const llama_grammar_element ** rules,
@@ -1157,6 +1439,7 @@ struct llama_grammar * llama_grammar_init_impl(
         /* .trigger_buffer_positions = */ {},
         /* .trigger_tokens = */           {},
         /* .trigger_patterns = */         {},
+        /* .trie_masks = */               {},
     };
 }
 
@@ -1263,6 +1546,7 @@ struct llama_grammar * llama_grammar_init_impl(
         /* .trigger_buffer_positions = */ {},
         std::move(vec_trigger_tokens),
         std::move(vec_trigger_patterns),
+        /* .trie_masks = */               {},
     };
 }
 
@@ -1286,6 +1570,7 @@ struct llama_grammar * llama_grammar_clone_impl(const struct llama_grammar & gra
         grammar.trigger_buffer_positions,
         grammar.trigger_tokens,
         grammar.trigger_patterns,
+        /* .trie_masks = */ {}, // keyed by stacks pointing into the old rules
     };
 
     // redirect elements in stacks to point to new rules
@@ -1319,6 +1604,53 @@ void llama_grammar_apply_impl(const struct llama_grammar & grammar, llama_token_
         }
     }
 
+    // with no partial code point pending, walk the shared vocab trie instead
+    // of decoding and checking every candidate separately; worthwhile unless
+    // earlier samplers already cut the candidates down to a few
+    const auto & vocab = *grammar.vocab;
+    if (grammar.partial_utf8.n_remain == 0 && cur_p->size * 4 >= vocab.n_tokens() &&
+            grammar.stacks.size() <= llama_grammar_trie_walk::MAX_STACKS) {
+        const std::vector<uint64_t> * mask = nullptr;
+
+        const auto it = grammar.trie_masks.find(grammar.stacks);
+        if (it != grammar.trie_masks.end()) {
+            mask = &it->second;
+        } else {
+            const auto & trie = vocab.get_grammar_trie();
+
+            std::vector<uint64_t> accepted((vocab.n_tokens() + 63) / 64, 0);
+            llama_grammar_trie_walk walk(grammar.rules, trie, accepted);
+
+            llama_grammar_stacks stacks = grammar.stacks;
+            const int sid = walk.intern(std::move(stacks));
+            if (sid >= 0) {
+                walk.walk(0, sid);
+            }
+
+            if (!walk.overflow) {
+                if (allow_eog) {
+                    for (const llama_token id : trie.eog) {
+                        walk.accept(id);
+                    }
+                }
+                if (grammar.trie_masks.size() >= LLAMA_GRAMMAR_MAX_TRIE_MASKS) {
+                    grammar.trie_masks.clear();
+                }
+                mask = &grammar.trie_masks.emplace(grammar.stacks, std::move(accepted)).first->second;
+            }
+        }
+
+        if (mask) {
+            for (size_t i = 0; i < cur_p->size; ++i) {
+                const llama_token id = cur_p->data[i].id;
+                if (!((*mask)[id >> 6] & (uint64_t(1) << (id & 63)))) {
+                    cur_p->data[i].logit = -INFINITY;
+                }
+            }
+            return;
+        }
+    }
+
     std::vector<std::pair<std::vector<uint32_t>, llama_partial_utf8>> candidates_decoded;
     candidates_decoded.reserve(cur_p->size);
 
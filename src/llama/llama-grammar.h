@@ -3,6 +3,7 @@
 #include "llama.h"
 
 #include <map>
+#include <memory>
 #include <regex>
 #include <string>
 #include <vector>
@@ -83,6 +84,29 @@ std::vector<llama_grammar_candidate> llama_grammar_reject_candidates_for_stack(
         const llama_grammar_stack      & stack,
         const llama_grammar_candidates & candidates);
 
+// prefix trie over the code points of every token piece, walked by
+// llama_grammar_apply_impl so that a rejected prefix rejects all tokens
+// sharing it at once
+struct llama_grammar_trie {
+    struct node {
+        uint32_t code_point;
+        uint32_t child_begin; // children are contiguous and sorted by code point
+        uint32_t child_end;
+        uint32_t tok_begin;   // tokens ending here: [tok_begin, tok_own_end)
+        uint32_t tok_own_end; // tokens further down: [tok_own_end, tok_end)
+        uint32_t tok_end;
+    };
+
+    std::vector<node>               nodes;   // nodes[0] is the root
+    std::vector<llama_token>        tokens;  // in trie order
+    std::vector<llama_partial_utf8> partial; // incomplete UTF-8 sequence ending each token
+    std::vector<llama_token>        eog;     // end-of-generation tokens, not in the trie
+};
+
+// pieces that are empty, start with a NUL or are not valid UTF-8 are left out,
+// as the grammar rejects them in any state
+std::unique_ptr<llama_grammar_trie> llama_grammar_trie_build(const llama_vocab & vocab);
+
 struct llama_grammar_parser {
     const llama_vocab * vocab;
     std::map<std::string, uint32_t> symbol_ids;
@@ -148,6 +172,9 @@ struct llama_grammar {
                              trigger_patterns;         // Regular expressions that trigger a lazy grammar. Must be a full match of the entire generated
                                                        // string, and the grammar will be given the string from the first match group onwards.
 
+    // token masks (one bit per token) computed by llama_grammar_apply_impl for
+    // the stacks seen so far, as generation often revisits the same state
+    mutable std::map<llama_grammar_stacks, std::vector<uint64_t>> trie_masks;
 };
 
 //
@@ -61,6 +61,7 @@ enum llama_vocab_pre_type {
 };
 
 struct LLM_KV;
+struct llama_grammar_trie;
 struct llama_model_loader;
 
 struct llama_vocab {
@@ -181,6 +182,10 @@ struct llama_vocab {
 
     void print_info() const;
 
+    // prefix trie over the token pieces, built on first use and shared by all
+    // grammars sampling from this vocab
+    const llama_grammar_trie & get_grammar_trie() const;
+
 private:
     struct impl;
     std::unique_ptr<impl> pimpl;
@@ -0,0 +1,231 @@
+// NUMA support behind edge_load_model(numa = ...) and edge_benchmark().
+//
+// The strategy is handed to ggml once per process, before the model it is
+// requested for is loaded. With a strategy set, llama.cpp maps model files
+// without prefetching, so every weight page is first touched, and therefore
+// placed, on the node of the worker thread that multiplies with it.
+//
+// The bandwidth probe first-touches one buffer per node from threads pinned
+// to that node, then measures how fast the CPUs of each node read each
+// buffer. Local reads are the diagonal; the rest is what a thread pays for
+// weights that ended up on another node.
+
+#include <Rcpp.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "llama.h"
+#include "ggml-cpu.h"
+
+using namespace Rcpp;
+
+static const char* EDGE_NUMA_STRATEGIES[] = {"disabled", "distribute", "isolate", "numactl"};
+
+static std::mutex g_numa_mutex;
+static int g_numa_strategy = GGML_NUMA_STRATEGY_DISABLED;
+
+// Apply a NUMA strategy for the rest of the session. ggml only takes one, so
+// asking for a different one later is an error. Requires the CPU backend to
+// be registered.
+void edge_numa_apply(int strategy) {
+  if (strategy == GGML_NUMA_STRATEGY_DISABLED) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(g_numa_mutex);
+  if (g_numa_strategy == GGML_NUMA_STRATEGY_DISABLED) {
+    llama_numa_init((enum ggml_numa_strategy)strategy);
+    g_numa_strategy = strategy;
+  } else if (g_numa_strategy != strategy) {
+    stop(std::string("The NUMA strategy is already '") + EDGE_NUMA_STRATEGIES[g_numa_strategy] +
+         "' for this session; restart R to use another one");
+  }
+}
+
+// Parse a sysfs CPU or node list such as "0-3,8-11"
+static std::vector<int> edge_parse_cpulist(const std::string& list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.empty() || range == "\n") continue;
+    const size_t dash = range.find('-');
+    try {
+      const int first = std::stoi(range.substr(0, dash));
+      const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    } catch (const std::exception&) {
+      // Malformed entry: skip it
+    }
+  }
+  return cpus;
+}
+
+struct EdgeNumaNode {
+  int id;
+  std::vector<int> cpus;
+};
+
+// Every online NUMA node with its CPUs. Node ids need not be contiguous
+// (offlined or hot-pluggable nodes leave gaps), so they come from the online
+// list rather than from probing node0, node1, ... Without NUMA information,
+// node 0 holding all CPUs.
+static std::vector<EdgeNumaNode> edge_numa_nodes() {
+  std::vector<EdgeNumaNode> nodes;
+#ifdef __linux__
+  std::ifstream online("/sys/devices/system/node/online");
+  if (online.is_open()) {
+    std::string ids;
+    std::getline(online, ids);
+    for (int id : edge_parse_cpulist(ids)) {
+      std::ifstream f("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+      if (!f.is_open()) {
+        continue;
+      }
+      std::string list;
+      std::getline(f, list);
+      nodes.push_back({id, edge_parse_cpulist(list)});
+    }
+  }
+#endif
+  if (nodes.empty()) {
+    std::vector<int> all(std::max(1u, std::thread::hardware_concurrency()));
+    for (size_t i = 0; i < all.size(); ++i) all[i] = (int)i;
+    nodes.push_back({0, all});
+  }
+  return nodes;
+}
+
+// Restrict the calling thread to `cpus`. Best effort: a no-op where thread
+// affinity is not available.
+static void edge_pin_thread(const std::vector<int>& cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+  }
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)cpus;
+#endif
+}
+
+// Run fn(thread index, n threads) on one thread per CPU of `cpus`, each
+// allowed on all of them, and wait for all
+template <typename F>
+static void edge_run_on_node(const std::vector<int>& cpus, F fn) {
+  const int n = (int)cpus.size();
+  std::vector<std::thread> threads;
+  threads.reserve(n);
+  for (int t = 0; t < n; ++t) {
+    threads.emplace_back([&cpus, &fn, t, n]() {
+      edge_pin_thread(cpus);
+      fn(t, n);
+    });
+  }
+  for (auto& th : threads) {
+    th.join();
+  }
+}
+
+// [[Rcpp::export]]
+List edge_numa_info_internal() {
+  const std::vector<EdgeNumaNode> nodes = edge_numa_nodes();
+  List node_cpus((int)nodes.size());
+  IntegerVector node_ids((int)nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    node_cpus[i] = IntegerVector(nodes[i].cpus.begin(), nodes[i].cpus.end());
+    node_ids[i] = nodes[i].id;
+  }
+
+  int strategy;
+  {
+    std::lock_guard<std::mutex> lock(g_numa_mutex);
+    strategy = g_numa_strategy;
+  }
+
+  return List::create(
+    Named("strategy") = std::string(EDGE_NUMA_STRATEGIES[strategy]),
+    Named("n_nodes") = (int)nodes.size(),
+    Named("node_ids") = node_ids,
+    Named("node_cpus") = node_cpus
+  );
+}
+
+// [[Rcpp::export]]
+DataFrame edge_memory_bandwidth_internal(double size_mb = 256, int repeats = 3) {
+  // Memory-only nodes have no CPUs to place or read a buffer from
+  std::vector<int> ids;
+  std::vector<std::vector<int>> nodes;
+  for (const EdgeNumaNode& node : edge_numa_nodes()) {
+    if (!node.cpus.empty()) {
+      ids.push_back(node.id);
+      nodes.push_back(node.cpus);
+    }
+  }
+  const int n_nodes = (int)nodes.size();
+  const size_t n_words = std::max<size_t>(1024, (size_t)(size_mb * 1024 * 1024) / sizeof(uint64_t));
+
+  // One buffer per node, first touched by that node's CPUs so the kernel
+  // places its pages there. Not value-initialized, which would touch it here.
+  std::vector<std::unique_ptr<uint64_t[]>> buffers(n_nodes);
+  for (int node = 0; node < n_nodes; ++node) {
+    buffers[node].reset(new uint64_t[n_words]);
+    uint64_t* buf = buffers[node].get();
+    edge_run_on_node(nodes[node], [buf, n_words](int t, int n) {
+      const size_t begin = n_words * t / n, end = n_words * (t + 1) / n;
+      for (size_t i = begin; i < end; ++i) buf[i] = i;
+    });
+  }
+
+  IntegerVector cpu_node(n_nodes * n_nodes), memory_node(n_nodes * n_nodes);
+  NumericVector gb_per_sec(n_nodes * n_nodes);
+  std::atomic<uint64_t> sink(0);
+  for (int from = 0; from < n_nodes; ++from) {
+    for (int to = 0; to < n_nodes; ++to) {
+      const uint64_t* buf = buffers[to].get();
+      double best = 0.0;
+      for (int r = 0; r < std::max(1, repeats); ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        edge_run_on_node(nodes[from], [buf, n_words, &sink](int t, int n) {
+          const size_t begin = n_words * t / n, end = n_words * (t + 1) / n;
+          uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+          size_t i = begin;
+          for (; i + 4 <= end; i += 4) {
+            s0 += buf[i]; s1 += buf[i + 1]; s2 += buf[i + 2]; s3 += buf[i + 3];
+          }
+          for (; i < end; ++i) s0 += buf[i];
+          sink.fetch_add(s0 + s1 + s2 + s3, std::memory_order_relaxed);
+        });
+        const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::max(best, (double)(n_words * sizeof(uint64_t)) / 1e9 / std::max(secs, 1e-9));
+      }
+      const int k = from * n_nodes + to;
+      cpu_node[k] = ids[from];
+      memory_node[k] = ids[to];
+      gb_per_sec[k] = best;
+    }
+  }
+
+  return DataFrame::create(
+    Named("cpu_node") = cpu_node,
+    Named("memory_node") = memory_node,
+    Named("gb_per_sec") = gb_per_sec
+  );
+}
@@ -2,9 +2,57 @@
 #include <vector>
 #include <string>
 
+#include "cpu_dispatch.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
 // This file MUST be compiled with GGML_CXXFLAGS (not standard R CXXFLAGS)
 // to correctly detect SIMD features enabled for the GGML engine.
 
+// Whether the host CPU has the AMX int8 tile instructions (CPUID leaf 7,
+// EDX bit 25), whatever the package was built with
+static bool edge_cpu_has_amx_int8() {
+#if defined(__x86_64__) || defined(_M_X64)
+#if defined(_MSC_VER)
+  int regs[4];
+  __cpuidex(regs, 0, 0);
+  if (regs[0] < 7) return false;
+  __cpuidex(regs, 7, 0);
+  return ((unsigned int)regs[3] >> 25) & 1;
+#else
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid_max(0, NULL) < 7) return false;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return (edx >> 25) & 1;
+#endif
+#else
+  return false;
+#endif
+}
+
+// Whether the CPU backend offers the AMX buffer type, which llama.cpp then
+// loads quantized weights into. Only builds with the AMX kernels register
+// it, and only once the OS has allowed this process to use the tiles.
+static bool edge_amx_active() {
+  ggml_backend_reg_t reg = ggml_backend_cpu_reg();
+  ggml_backend_dev_t dev = ggml_backend_reg_dev_get(reg, 0);
+  auto get_extra_bufts = (ggml_backend_dev_get_extra_bufts_t)
+    ggml_backend_reg_get_proc_address(reg, "ggml_backend_dev_get_extra_bufts");
+  if (!dev || !get_extra_bufts) return false;
+  for (ggml_backend_buffer_type_t* buft = get_extra_bufts(dev); buft && *buft; ++buft) {
+    if (std::string(ggml_backend_buft_name(*buft)) == "AMX") return true;
+  }
+  return false;
+}
+
 // [[Rcpp::export]]
 Rcpp::List edge_simd_info_internal() {
   std::vector<std::string> features;
@@ -48,6 +96,15 @@ Rcpp::List edge_simd_info_internal() {
 #ifdef __AVX512VL__
   features.push_back("AVX512VL");
 #endif
+#ifdef __AVX512VNNI__
+  features.push_back("AVX512VNNI");
+#endif
+#ifdef __AMX_TILE__
+  features.push_back("AMX_TILE");
+#endif
+#ifdef __AMX_INT8__
+  features.push_back("AMX_INT8");
+#endif
 #ifdef __ARM_NEON
   features.push_back("NEON");
 #endif
@@ -96,14 +153,39 @@ Rcpp::List edge_simd_info_internal() {
 #ifdef GGML_AVX512
   ggml_features.push_back("GGML_AVX512");
 #endif
+#ifdef GGML_AVX512_VNNI
+  ggml_features.push_back("GGML_AVX512_VNNI");
+#endif
+#ifdef GGML_AMX_INT8
+  ggml_features.push_back("GGML_AMX_INT8");
+#endif
 #ifdef GGML_CPU_GENERIC
   ggml_features.push_back("GGML_CPU_GENERIC");
 #endif
+#ifdef EDGEMODELR_CPU_DISPATCH
+  ggml_features.push_back("EDGEMODELR_CPU_DISPATCH");
+#endif
+
+  // Kernel variant picked at load time (runtime dispatch builds), or the
+  // level fixed at compile time otherwise
+  std::vector<std::string> cpu_variants;
+  std::vector<bool> cpu_variants_supported;
+  for (int i = 0; i < edge_cpu_dispatch_n_variants(); ++i) {
+    cpu_variants.push_back(edge_cpu_dispatch_variant_name(i));
+    cpu_variants_supported.push_back(edge_cpu_dispatch_variant_supported(i) != 0);
+  }
+  Rcpp::LogicalVector supported = Rcpp::wrap(cpu_variants_supported);
+  supported.attr("names") = cpu_variants;
 
   return Rcpp::List::create(
     Rcpp::Named("architecture") = arch,
     Rcpp::Named("compiler_features") = features,
     Rcpp::Named("ggml_features") = ggml_features,
-    Rcpp::Named("is_generic") = is_generic
+    Rcpp::Named("is_generic") = is_generic,
+    Rcpp::Named("runtime_dispatch") = edge_cpu_dispatch_enabled() != 0,
+    Rcpp::Named("cpu_variant") = std::string(edge_cpu_dispatch_variant()),
+    Rcpp::Named("cpu_variants_supported") = supported,
+    Rcpp::Named("amx") = edge_amx_active(),
+    Rcpp::Named("amx_supported") = edge_cpu_has_amx_int8()
   );
 }
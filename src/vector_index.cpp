@@ -0,0 +1,502 @@
+// Native embedding index behind edge_index_documents() / edge_search().
+//
+// Rows are stored contiguously, either as float32 or as int8 (ggml Q8_0
+// blocks: 32 int8 values sharing one fp16 scale), and scored with ggml's CPU
+// dot-product kernels. The int8 path therefore runs the same SIMD kernels as
+// quantized model weights, including runtime CPU dispatch. Top-k selection
+// keeps a bounded min-heap instead of sorting every score.
+//
+// An index can be saved to a versioned binary file (see the format below)
+// and opened again with a read-only shared mapping (llama_mmap), so opening
+// is independent of the index size and every process on a host shares the
+// same page-cache copy.
+
+#include <Rcpp.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <queue>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+#include "llama-mmap.h"
+
+using namespace Rcpp;
+
+// On-disk layout (native byte order, every section 64-byte aligned):
+//
+//   EdgeIndexFileHeader
+//   rows          n_rows * row_size bytes
+//   text offsets  uint64[n_rows + 1] into the text blob
+//   text blob     chunk texts, concatenated
+//   source ids    int32[n_rows], index into the source table or -1 for NA
+//   src offsets   uint64[n_sources + 1] into the source blob
+//   source blob   source paths, concatenated
+static const char EDGE_INDEX_MAGIC[8] = {'E', 'D', 'G', 'E', 'I', 'D', 'X', '\0'};
+static const uint32_t EDGE_INDEX_VERSION = 1;
+static const uint64_t EDGE_INDEX_ALIGN = 64;
+
+struct EdgeIndexFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t type;          // ggml_type of the rows
+  uint32_t n_dim;
+  uint32_t n_dim_padded;
+  uint64_t row_size;
+  uint64_t n_rows;
+  uint64_t n_sources;
+  uint64_t rows_offset;
+  uint64_t text_offsets_offset;
+  uint64_t text_offset;
+  uint64_t text_size;
+  uint64_t source_ids_offset;
+  uint64_t source_offsets_offset;
+  uint64_t source_offset;
+  uint64_t source_size;
+};
+
+struct EdgeVectorIndex {
+  ggml_type type = GGML_TYPE_F32;
+  int n_dim = 0;          // embedding dimension
+  int n_dim_padded = 0;   // n_dim rounded up to the block size of `type`
+  size_t row_size = 0;    // bytes per stored row
+  int64_t n_rows = 0;
+  std::vector<uint8_t> data;
+
+  // Set when the index was opened from a file; rows, chunk texts and sources
+  // then point into the read-only mapping and `data` stays empty
+  std::string path;
+  std::unique_ptr<llama_file> file;
+  std::unique_ptr<llama_mmap> mapping;
+  const uint8_t* mapped_rows = nullptr;
+  EdgeIndexFileHeader header = {};
+
+  bool is_mapped() const {
+    return mapping != nullptr;
+  }
+
+  const uint8_t* row(int64_t i) const {
+    return (is_mapped() ? mapped_rows : data.data()) + (size_t)i * row_size;
+  }
+
+  const uint8_t* mapped_at(uint64_t offset) const {
+    return static_cast<const uint8_t*>(mapping->addr()) + offset;
+  }
+
+  // i-th entry of a mapped string table, bounds-checked against its blob
+  std::string mapped_string(uint64_t offsets_offset, uint64_t blob_offset, uint64_t blob_size, uint64_t i) const {
+    const uint64_t* offsets = reinterpret_cast<const uint64_t*>(mapped_at(offsets_offset));
+    const uint64_t begin = offsets[i];
+    const uint64_t end = offsets[i + 1];
+    if (begin > end || end > blob_size) {
+      stop("Corrupt index file: string offset out of range");
+    }
+    return std::string(reinterpret_cast<const char*>(mapped_at(blob_offset + begin)), end - begin);
+  }
+
+  // Convert one float row to the storage / query format `t`, zero-padding the
+  // tail so it does not contribute to dot products
+  void convert(const float* src, ggml_type t, uint8_t* dst, std::vector<float>& scratch) const {
+    scratch.assign(n_dim_padded, 0.0f);
+    std::copy(src, src + n_dim, scratch.begin());
+    if (t == GGML_TYPE_F32) {
+      std::memcpy(dst, scratch.data(), (size_t)n_dim_padded * sizeof(float));
+    } else {
+      ggml_get_type_traits_cpu(t)->from_float(scratch.data(), dst, n_dim_padded);
+    }
+  }
+};
+
+namespace {
+
+typedef std::pair<float, int64_t> scored_row;
+
+// Higher score first; ties keep the lower row first, like order(decreasing = TRUE)
+struct better_hit {
+  bool operator()(const scored_row& a, const scored_row& b) const {
+    return a.first > b.first || (a.first == b.first && a.second < b.second);
+  }
+};
+
+// Min-heap on better_hit: the top is the worst of the current best k
+typedef std::priority_queue<scored_row, std::vector<scored_row>, better_hit> topk_heap;
+
+void scan_rows(const EdgeVectorIndex* index, const void* query, int64_t begin, int64_t end,
+               int top_k, std::vector<scored_row>* out) {
+  const ggml_vec_dot_t vec_dot = ggml_get_type_traits_cpu(index->type)->vec_dot;
+  topk_heap heap;
+  for (int64_t i = begin; i < end; ++i) {
+    float score = 0.0f;
+    vec_dot(index->n_dim_padded, &score, 0, index->row(i), 0, query, 0, 1);
+    if ((int)heap.size() < top_k) {
+      heap.push(scored_row(score, i));
+    } else if (better_hit()(scored_row(score, i), heap.top())) {
+      heap.pop();
+      heap.push(scored_row(score, i));
+    }
+  }
+  out->clear();
+  while (!heap.empty()) {
+    out->push_back(heap.top());
+    heap.pop();
+  }
+}
+
+ggml_type parse_index_type(const std::string& type) {
+  if (type == "float32") return GGML_TYPE_F32;
+  if (type == "int8") return GGML_TYPE_Q8_0;
+  stop("Unknown index type '" + type + "' (expected \"float32\" or \"int8\")");
+}
+
+} // namespace
+
+// [[Rcpp::export]]
+SEXP edge_vector_index_create_internal(int n_dim, std::string type = "float32") {
+  try {
+    if (n_dim <= 0) {
+      stop("n_dim must be positive");
+    }
+
+    // Initializes the fp16 conversion tables used by the Q8_0 kernels
+    ggml_cpu_init();
+
+    auto index = std::make_unique<EdgeVectorIndex>();
+    index->type = parse_index_type(type);
+    const int block = (int)ggml_blck_size(index->type);
+    index->n_dim = n_dim;
+    index->n_dim_padded = (n_dim + block - 1) / block * block;
+    index->row_size = ggml_row_size(index->type, index->n_dim_padded);
+
+    XPtr<EdgeVectorIndex> ptr(index.release(), true);
+    ptr.attr("class") = "edge_vector_index";
+    return ptr;
+  } catch (const std::exception& e) {
+    stop("Error creating vector index: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+int edge_vector_index_add_internal(SEXP index_ptr, NumericMatrix embeddings) {
+  try {
+    XPtr<EdgeVectorIndex> index(index_ptr);
+    if (index->is_mapped()) {
+      stop("Index opened from a file is read-only");
+    }
+    if (embeddings.ncol() != index->n_dim) {
+      stop("embeddings have " + std::to_string(embeddings.ncol()) +
+           " columns, index expects " + std::to_string(index->n_dim));
+    }
+
+    const int n_new = embeddings.nrow();
+    index->data.resize((size_t)(index->n_rows + n_new) * index->row_size);
+
+    std::vector<float> row(index->n_dim);
+    std::vector<float> scratch;
+    for (int i = 0; i < n_new; ++i) {
+      for (int j = 0; j < index->n_dim; ++j) {
+        row[j] = static_cast<float>(embeddings(i, j));
+      }
+      uint8_t* dst = index->data.data() + (size_t)(index->n_rows + i) * index->row_size;
+      index->convert(row.data(), index->type, dst, scratch);
+    }
+    index->n_rows += n_new;
+
+    return static_cast<int>(index->n_rows);
+  } catch (const std::exception& e) {
+    stop("Error adding to vector index: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+List edge_vector_index_search_internal(SEXP index_ptr, NumericVector query, int top_k = 5) {
+  try {
+    XPtr<EdgeVectorIndex> index(index_ptr);
+    if (query.size() != index->n_dim) {
+      stop("query has length " + std::to_string(query.size()) +
+           ", index expects " + std::to_string(index->n_dim));
+    }
+    top_k = (int)std::min<int64_t>(std::max(top_k, 0), index->n_rows);
+
+    // Bring the query into the format the row kernel expects (Q8_0 rows are
+    // dotted against a Q8_0 query)
+    const ggml_type query_type = ggml_get_type_traits_cpu(index->type)->vec_dot_type;
+    std::vector<float> q(index->n_dim);
+    for (int j = 0; j < index->n_dim; ++j) {
+      q[j] = static_cast<float>(query[j]);
+    }
+    std::vector<uint8_t> query_buf(ggml_row_size(query_type, index->n_dim_padded));
+    std::vector<float> scratch;
+    index->convert(q.data(), query_type, query_buf.data(), scratch);
+
+    // Large indexes are scanned in parallel, one slice and heap per thread
+    const int64_t min_rows_per_thread = 16384;
+    const int hardware_threads = std::max(1, (int)std::thread::hardware_concurrency());
+    const int n_threads = (int)std::max<int64_t>(1,
+      std::min<int64_t>(hardware_threads, index->n_rows / min_rows_per_thread));
+
+    std::vector<std::vector<scored_row>> partial(n_threads);
+    if (top_k > 0) {
+      const int64_t per_thread = (index->n_rows + n_threads - 1) / n_threads;
+      std::vector<std::thread> workers;
+      for (int t = 1; t < n_threads; ++t) {
+        const int64_t begin = std::min(index->n_rows, t * per_thread);
+        const int64_t end = std::min(index->n_rows, begin + per_thread);
+        workers.emplace_back(scan_rows, index.get(), query_buf.data(), begin, end, top_k, &partial[t]);
+      }
+      scan_rows(index.get(), query_buf.data(), 0, std::min(index->n_rows, per_thread), top_k, &partial[0]);
+      for (auto& w : workers) {
+        w.join();
+      }
+    }
+
+    std::vector<scored_row> hits;
+    for (const auto& p : partial) {
+      hits.insert(hits.end(), p.begin(), p.end());
+    }
+    std::sort(hits.begin(), hits.end(), better_hit());
+    hits.resize(std::min<size_t>(hits.size(), (size_t)top_k));
+
+    const int n_hits = static_cast<int>(hits.size());
+    IntegerVector rows(n_hits);
+    NumericVector scores(n_hits);
+    for (int i = 0; i < n_hits; ++i) {
+      rows[i] = static_cast<int>(hits[i].second + 1);
+      scores[i] = static_cast<double>(hits[i].first);
+    }
+
+    return List::create(
+      Named("index") = rows,
+      Named("score") = scores
+    );
+  } catch (const std::exception& e) {
+    stop("Error searching vector index: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+List edge_vector_index_info_internal(SEXP index_ptr) {
+  try {
+    XPtr<EdgeVectorIndex> index(index_ptr);
+    return List::create(
+      Named("type") = std::string(index->type == GGML_TYPE_F32 ? "float32" : "int8"),
+      Named("n_rows") = static_cast<double>(index->n_rows),
+      Named("n_dim") = index->n_dim,
+      Named("bytes") = static_cast<double>(index->n_rows) * static_cast<double>(index->row_size),
+      Named("mapped") = index->is_mapped(),
+      Named("path") = index->path
+    );
+  } catch (const std::exception& e) {
+    stop("Error reading vector index: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+bool edge_vector_index_valid_internal(SEXP index_ptr) {
+  try {
+    if (TYPEOF(index_ptr) != EXTPTRSXP) {
+      return false;
+    }
+    XPtr<EdgeVectorIndex> index(index_ptr);
+    return index.get() != nullptr;
+  } catch (...) {
+    return false;
+  }
+}
+
+namespace {
+
+uint64_t align_offset(uint64_t offset) {
+  return (offset + EDGE_INDEX_ALIGN - 1) / EDGE_INDEX_ALIGN * EDGE_INDEX_ALIGN;
+}
+
+// Writes sections sequentially, zero-padding up to each aligned offset
+struct index_writer {
+  llama_file file;
+  uint64_t pos = 0;
+
+  explicit index_writer(const std::string& path) : file(path.c_str(), "wb") {}
+
+  uint64_t begin_section() {
+    static const char zeros[EDGE_INDEX_ALIGN] = {0};
+    const uint64_t start = align_offset(pos);
+    if (start > pos) {
+      write(zeros, start - pos);
+    }
+    return start;
+  }
+
+  void write(const void* ptr, uint64_t len) {
+    if (len > 0) {
+      file.write_raw(ptr, len);
+      pos += len;
+    }
+  }
+};
+
+void write_string_table(index_writer& w, const std::vector<std::string>& strings,
+                        uint64_t* offsets_offset, uint64_t* blob_offset, uint64_t* blob_size) {
+  std::vector<uint64_t> offsets(strings.size() + 1, 0);
+  for (size_t i = 0; i < strings.size(); ++i) {
+    offsets[i + 1] = offsets[i] + strings[i].size();
+  }
+  *offsets_offset = w.begin_section();
+  w.write(offsets.data(), offsets.size() * sizeof(uint64_t));
+  *blob_offset = w.begin_section();
+  for (const auto& str : strings) {
+    w.write(str.data(), str.size());
+  }
+  *blob_size = offsets.back();
+}
+
+bool section_fits(uint64_t offset, uint64_t count, uint64_t elem_size, uint64_t file_size) {
+  return offset % EDGE_INDEX_ALIGN == 0 && offset <= file_size &&
+         (elem_size == 0 || count <= (file_size - offset) / elem_size);
+}
+
+} // namespace
+
+// [[Rcpp::export]]
+void edge_vector_index_save_internal(SEXP index_ptr, std::string path, std::vector<std::string> chunks,
+                                     IntegerVector source_ids, std::vector<std::string> sources) {
+  try {
+    XPtr<EdgeVectorIndex> index(index_ptr);
+    const uint64_t n_rows = (uint64_t)index->n_rows;
+    if (chunks.size() != n_rows || (uint64_t)source_ids.size() != n_rows) {
+      stop("chunks and source_ids must have one entry per indexed row");
+    }
+
+    EdgeIndexFileHeader h = {};
+    std::memcpy(h.magic, EDGE_INDEX_MAGIC, sizeof(h.magic));
+    h.version = EDGE_INDEX_VERSION;
+    h.type = (uint32_t)index->type;
+    h.n_dim = (uint32_t)index->n_dim;
+    h.n_dim_padded = (uint32_t)index->n_dim_padded;
+    h.row_size = index->row_size;
+    h.n_rows = n_rows;
+    h.n_sources = sources.size();
+
+    std::vector<int32_t> ids(n_rows);
+    for (uint64_t i = 0; i < n_rows; ++i) {
+      const int id = source_ids[i];
+      ids[i] = (id == NA_INTEGER || id < 0 || (uint64_t)id >= sources.size()) ? -1 : id;
+    }
+
+    // The header is written last, once every section offset is known
+    index_writer w(path);
+    w.write(&h, sizeof(h));
+
+    h.rows_offset = w.begin_section();
+    for (uint64_t i = 0; i < n_rows; ++i) {
+      w.write(index->row((int64_t)i), index->row_size);
+    }
+    write_string_table(w, chunks, &h.text_offsets_offset, &h.text_offset, &h.text_size);
+    h.source_ids_offset = w.begin_section();
+    w.write(ids.data(), ids.size() * sizeof(int32_t));
+    write_string_table(w, sources, &h.source_offsets_offset, &h.source_offset, &h.source_size);
+
+    w.file.seek(0, SEEK_SET);
+    w.file.write_raw(&h, sizeof(h));
+  } catch (const std::exception& e) {
+    stop("Error saving vector index: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+SEXP edge_vector_index_open_internal(std::string path) {
+  try {
+    ggml_cpu_init();
+
+    auto index = std::make_unique<EdgeVectorIndex>();
+    index->file = std::make_unique<llama_file>(path.c_str(), "rb");
+    const uint64_t file_size = index->file->size();
+    if (file_size < sizeof(EdgeIndexFileHeader)) {
+      stop("Not an edgemodelr index file: " + path);
+    }
+
+    // No prefetch: pages are faulted in (or found in the page cache) on use
+    index->mapping = std::make_unique<llama_mmap>(index->file.get(), 0, false);
+    std::memcpy(&index->header, index->mapping->addr(), sizeof(EdgeIndexFileHeader));
+    const EdgeIndexFileHeader& h = index->header;
+
+    if (std::memcmp(h.magic, EDGE_INDEX_MAGIC, sizeof(h.magic)) != 0) {
+      stop("Not an edgemodelr index file: " + path);
+    }
+    if (h.version != EDGE_INDEX_VERSION) {
+      stop("Unsupported index file version " + std::to_string(h.version) +
+           " (this build reads version " + std::to_string(EDGE_INDEX_VERSION) + ")");
+    }
+    if (h.type != GGML_TYPE_F32 && h.type != GGML_TYPE_Q8_0) {
+      stop("Unsupported row type in index file");
+    }
+
+    index->type = (ggml_type)h.type;
+    index->n_dim = (int)h.n_dim;
+    index->n_dim_padded = (int)h.n_dim_padded;
+    index->row_size = h.row_size;
+    index->n_rows = (int64_t)h.n_rows;
+
+    const bool valid =
+      h.n_dim > 0 && h.n_dim_padded >= h.n_dim &&
+      h.n_dim_padded % ggml_blck_size(index->type) == 0 &&
+      h.row_size == ggml_row_size(index->type, h.n_dim_padded) &&
+      section_fits(h.rows_offset, h.n_rows, h.row_size, file_size) &&
+      section_fits(h.text_offsets_offset, h.n_rows + 1, sizeof(uint64_t), file_size) &&
+      section_fits(h.text_offset, h.text_size, 1, file_size) &&
+      section_fits(h.source_ids_offset, h.n_rows, sizeof(int32_t), file_size) &&
+      section_fits(h.source_offsets_offset, h.n_sources + 1, sizeof(uint64_t), file_size) &&
+      section_fits(h.source_offset, h.source_size, 1, file_size);
+    if (!valid) {
+      stop("Corrupt or truncated index file: " + path);
+    }
+
+    index->mapped_rows = index->mapped_at(h.rows_offset);
+    index->path = path;
+
+    XPtr<EdgeVectorIndex> ptr(index.release(), true);
+    ptr.attr("class") = "edge_vector_index";
+    return ptr;
+  } catch (const std::exception& e) {
+    stop("Error opening vector index: " + std::string(e.what()));
+  }
+}
+
+// [[Rcpp::export]]
+List edge_vector_index_rows_internal(SEXP index_ptr, IntegerVector rows) {
+  try {
+    XPtr<EdgeVectorIndex> index(index_ptr);
+    if (!index->is_mapped()) {
+      stop("Chunk texts are only stored in indexes opened from a file");
+    }
+    const EdgeIndexFileHeader& h = index->header;
+    const int32_t* source_ids = reinterpret_cast<const int32_t*>(index->mapped_at(h.source_ids_offset));
+
+    const int n = static_cast<int>(rows.size());
+    CharacterVector chunk(n);
+    CharacterVector source(n);
+    for (int i = 0; i < n; ++i) {
+      const int row = rows[i];
+      if (row == NA_INTEGER || row < 1 || row > index->n_rows) {
+        stop("Row " + std::to_string(row) + " is out of range");
+      }
+      chunk[i] = index->mapped_string(h.text_offsets_offset, h.text_offset, h.text_size, row - 1);
+      const int32_t id = source_ids[row - 1];
+      if (id >= 0 && (uint64_t)id < h.n_sources) {
+        source[i] = index->mapped_string(h.source_offsets_offset, h.source_offset, h.source_size, id);
+      } else {
+        source[i] = NA_STRING;
+      }
+    }
+
+    return List::create(
+      Named("chunk") = chunk,
+      Named("source") = source
+    );
+  } catch (const std::exception& e) {
+    stop("Error reading vector index: " + std::string(e.what()));
+  }
+}